@@ -0,0 +1,647 @@
+#ifndef _HV_DUMP_H_
+#define _HV_DUMP_H_
+// hive lookups and output: the HVFILE.idx sidecar index, key lookup by
+// path, the .reg and raw dumpers, and regwriter, which formats keys and
+// values as a dump does.
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <sys/stat.h>
+#include "hvfile.h"
+#include "mappedfile.h"
+
+// a sidecar index file, HVFILE.idx, for fast lookups in a hive that does
+// not change. it holds, in host byte order:
+//
+//   header         magic, version, byte order, the filemd5 and filesize of the hive
+//   entryofs[n]    id -> entry offset relative to 0x5000, 0 for unused ids
+//   parent[n]      key id -> parent key id, 0 for top level keys
+//   firstvalue[n]  key id -> first value
+//   buckets[m]     open addressing table: folded path hash -> key id
+//
+// the index belongs to the hive with the filemd5 at +000c, a stale index is
+// not used. it is mapped read-only, so processes share it through the page cache.
+class hiveindexfile {
+    struct header {
+        char magic[4];          // "HVIX"
+        uint32_t version;
+        uint32_t byteorder;     // 0x01020304
+        uint32_t nentries;
+        uint8_t filemd5[16];
+        uint64_t filesize;
+        uint32_t nbuckets;      // a power of 2
+        uint32_t nkeys;
+    };
+    struct bucket {
+        uint64_t hash;
+        uint32_t id;            // 0 for empty buckets
+        uint32_t unused;
+    };
+    enum { VERSION= 1 };
+
+    mappedfile _f;
+    const header *_hdr;
+    const uint32_t *_entryofs;
+    const uint32_t *_parent;
+    const uint32_t *_firstvalue;
+    const bucket *_buckets;
+
+    hiveindexfile(const std::string& idxname)
+        : _f(idxname), _hdr(NULL)
+    {
+    }
+    // checks the index file belongs to image, and sets the table pointers.
+    // the md5 only covers the hive, so the tables are checked as well: a
+    // corrupt index must not make readentry read past the end of the image,
+    // make findkey probe forever, or have a cycle in the parent links.
+    bool validate(const uint8_t *image, uint64_t imagesize, uint32_t maxentries)
+    {
+        if (_f.size()<sizeof(header))
+            return false;
+        _hdr= (const header*)_f.data();
+        if (memcmp(_hdr->magic, "HVIX", 4)!=0 || _hdr->version!=VERSION || _hdr->byteorder!=0x01020304)
+            return false;
+        if (_hdr->filesize!=imagesize || imagesize<0x1c || memcmp(_hdr->filemd5, image+0x0c, 16)!=0)
+            return false;
+        if ((_hdr->nbuckets&(_hdr->nbuckets-1)) || _f.size()!=filesize(_hdr->nentries, _hdr->nbuckets))
+            return false;
+        if (_hdr->nentries>maxentries || imagesize<0x5000)
+            return false;
+        _entryofs= (const uint32_t*)(_f.data()+sizeof(header));
+        for (uint32_t i=0 ; i<_hdr->nentries ; i++)
+            if (_entryofs[i] && _entryofs[i]>=imagesize-0x5000)
+                return false;
+        _parent= _entryofs+_hdr->nentries;
+        _firstvalue= _parent+_hdr->nentries;
+        _buckets= (const bucket*)(_f.data()+tablesofs(_hdr->nentries));
+
+        // write makes the table at least twice the nr of keys
+        if (_hdr->nbuckets==0 || _hdr->nbuckets/2<_hdr->nkeys)
+            return false;
+        uint32_t nused= 0;
+        for (uint32_t i=0 ; i<_hdr->nbuckets ; i++)
+            if (_buckets[i].id)
+                nused++;
+        if (nused!=_hdr->nkeys)
+            return false;
+
+        // each parent chain must end at 0: 1 = on the current chain, 2 = ends at 0
+        std::vector<uint8_t> state(_hdr->nentries);
+        std::vector<uint32_t> chain;
+        for (uint32_t i=0 ; i<_hdr->nentries ; i++) {
+            uint32_t k= i;
+            while (k && state[k]==0) {
+                state[k]= 1;
+                chain.push_back(k);
+                k= _parent[k];
+                if (k>=_hdr->nentries)
+                    return false;
+            }
+            if (k && state[k]==1)
+                return false;
+            for (auto c : chain)
+                state[c]= 2;
+            chain.clear();
+        }
+        return true;
+    }
+    static size_t tablesofs(uint32_t nentries)
+    {
+        return (sizeof(header)+3*sizeof(uint32_t)*nentries+7)&~size_t(7);
+    }
+    static size_t filesize(uint32_t nentries, uint32_t nbuckets)
+    {
+        return tablesofs(nentries)+nbuckets*sizeof(bucket);
+    }
+public:
+    static std::string indexname(const std::string& hvfile) { return hvfile+".idx"; }
+
+    // the hash of a key path, relative to its root, case insensitive
+    static uint64_t pathhash(int root, std::string_view path)
+    {
+        return foldednamehash(path) ^ ((uint64_t(root)+1) * 0x9e3779b97f4a7c15ULL);
+    }
+
+    // open the index of hvfile, returns NULL when there is none, or when
+    // it does not belong to the hive in image, with maxentries id slots.
+    static std::shared_ptr<hiveindexfile> open(const std::string& hvfile, const uint8_t *image, uint64_t imagesize, uint32_t maxentries)
+    {
+        struct stat st;
+        std::string idxname= indexname(hvfile);
+        if (::stat(idxname.c_str(), &st)==-1)
+            return NULL;
+        std::shared_ptr<hiveindexfile> idx(new hiveindexfile(idxname));
+        if (!idx->validate(image, imagesize, maxentries)) {
+            if (g_verbose)
+                printf("%s: stale index, not used\n", idxname.c_str());
+            return NULL;
+        }
+        return idx;
+    }
+
+    // write the index of the hive in image, decoded in tab, to idxname
+    static void write(const std::string& idxname, const uint8_t *image, uint64_t imagesize, const DwordVector& entryofs, hivetable& tab)
+    {
+        uint32_t nentries= entryofs.size();
+        DwordVector parent(nentries);
+        DwordVector firstvalue(nentries);
+
+        // all keys with their path, see dumper::dumpkeys
+        struct keypath {
+            int root;
+            uint32_t id;
+            std::string path;
+        };
+        std::vector<std::pair<uint64_t,uint32_t>> keys;
+        std::vector<bool> visited(nentries);
+        std::vector<keypath> stack;
+        for (int root= ent::HKCR ; root<=ent::HKLM ; root++)
+        {
+            for (uint32_t id= tab.hiveid(root) ; id<nentries && tab.iskey(id) && !visited[id] ; id= tab.nextsibling(id)) {
+                visited[id]= true;
+                stack.push_back(keypath{root, id, tab.name(id)});
+            }
+            while (!stack.empty()) {
+                keypath k= stack.back();
+                stack.pop_back();
+                keys.push_back(std::make_pair(pathhash(root, k.path), k.id));
+                firstvalue[k.id]= tab.firstvalue(k.id);
+                for (uint32_t c= tab.firstchild(k.id) ; c<nentries && tab.iskey(c) && !visited[c] ; c= tab.nextsibling(c)) {
+                    visited[c]= true;
+                    parent[c]= k.id;
+                    stack.push_back(keypath{root, c, k.path+"\\"+tab.name(c)});
+                }
+            }
+        }
+
+        uint32_t nbuckets= 16;
+        while (nbuckets < 2*keys.size())
+            nbuckets *= 2;
+
+        ByteVector data(filesize(nentries, nbuckets));
+        header *hdr= (header*)data.data();
+        memcpy(hdr->magic, "HVIX", 4);
+        hdr->version= VERSION;
+        hdr->byteorder= 0x01020304;
+        hdr->nentries= nentries;
+        memcpy(hdr->filemd5, image+0x0c, 16);
+        hdr->filesize= imagesize;
+        hdr->nbuckets= nbuckets;
+        hdr->nkeys= keys.size();
+
+        uint32_t *tables= (uint32_t*)(data.data()+sizeof(header));
+        std::copy(entryofs.begin(), entryofs.end(), tables);
+        std::copy(parent.begin(), parent.end(), tables+nentries);
+        std::copy(firstvalue.begin(), firstvalue.end(), tables+2*nentries);
+
+        bucket *buckets= (bucket*)(data.data()+tablesofs(nentries));
+        for (auto& k : keys) {
+            uint32_t i= k.first&(nbuckets-1);
+            while (buckets[i].id)
+                i= (i+1)&(nbuckets-1);
+            buckets[i].hash= k.first;
+            buckets[i].id= k.second;
+        }
+
+        std::string tmpname= idxname+".tmp";
+        FILE *f= fopen(tmpname.c_str(), "wb");
+        if (f==NULL)
+            throw stringformat("%s: %s", tmpname.c_str(), strerror(errno));
+        bool ok= fwrite(data.data(), 1, data.size(), f)==data.size();
+        if (fclose(f)!=0)
+            ok= false;
+        if (!ok || rename(tmpname.c_str(), idxname.c_str())!=0)
+            throw stringformat("%s: %s", idxname.c_str(), strerror(errno));
+    }
+
+    const uint32_t *entryofs() const { return _entryofs; }
+    uint32_t nentries() const { return _hdr->nentries; }
+    uint32_t parent(uint32_t id) const { return id<_hdr->nentries ? _parent[id] : 0; }
+    uint32_t firstvalue(uint32_t id) const { return id<_hdr->nentries ? _firstvalue[id] : 0; }
+
+    // call cb for each key id with the hash of path, until it returns true
+    template<typename FN>
+    uint32_t findkey(int root, std::string_view path, FN cb) const
+    {
+        uint64_t h= pathhash(root, path);
+        uint32_t mask= _hdr->nbuckets-1;
+        for (uint32_t i= h&mask ; _buckets[i].id ; i= (i+1)&mask)
+            if (_buckets[i].hash==h && cb(_buckets[i].id))
+                return _buckets[i].id;
+        return 0;
+    }
+};
+
+// lookup of keys and values by name, case insensitive, as in windows.
+//
+// the subkeys and values of a key are indexed by name hash the first
+// time the key is searched, so repeated lookups cost O(depth).
+class keyindex {
+    hivesource& _hv;
+    const hiveindexfile *_sidecar;
+
+    // (parent, kind, folded name hash) -> id, verified by name on lookup
+    std::unordered_multimap<uint64_t,uint32_t> _index;
+    std::unordered_set<uint64_t> _indexed;
+
+    enum { KIND_KEY, KIND_VALUE };
+    // the top level keys of a hive are the children of parent ROOTPARENT+root
+    enum { ROOTPARENT= 0x10000000 };
+
+    static uint64_t hashkey(uint32_t parent, int kind, const std::string& name)
+    {
+        return foldednamehash(name) ^ ((uint64_t(parent)<<1|kind) * 0x9e3779b97f4a7c15ULL);
+    }
+
+    void indexchain(uint32_t parent, int kind, uint32_t id)
+    {
+        if (!_indexed.insert(uint64_t(parent)<<1|kind).second)
+            return;
+        std::unordered_set<uint32_t> visited;
+        while (id && (kind==KIND_KEY ? _hv.iskey(id) : _hv.isvalue(id)) && visited.insert(id).second) {
+            _index.insert(std::make_pair(hashkey(parent, kind, _hv.name(id)), id));
+            id= kind==KIND_KEY ? _hv.nextsibling(id) : _hv.nextvalue(id);
+        }
+    }
+    uint32_t lookup(uint32_t parent, int kind, const std::string& name)
+    {
+        auto range= _index.equal_range(hashkey(parent, kind, name));
+        for (auto i= range.first ; i!=range.second ; ++i)
+            if (foldednameequal(_hv.name(i->second), name))
+                return i->second;
+        return 0;
+    }
+public:
+    keyindex(hivesource& hv)
+        : _hv(hv), _sidecar(NULL)
+    {
+    }
+    // look up paths in a sidecar index, instead of walking the sibling chains
+    void usesidecar(const hiveindexfile *idx) { _sidecar= idx; }
+
+    // find a direct subkey of key parent
+    uint32_t findchild(uint32_t parent, const std::string& name)
+    {
+        // a hive without roots, or a parent which is not a key, has no children
+        uint32_t first= 0;
+        if (parent>=ROOTPARENT ? _hv.hasroots() : _hv.iskey(parent))
+            first= parent>=ROOTPARENT ? _hv.hiveid(parent-ROOTPARENT) : _hv.firstchild(parent);
+        indexchain(parent, KIND_KEY, first);
+        return lookup(parent, KIND_KEY, name);
+    }
+    // find a value of key id
+    uint32_t findvalue(uint32_t id, const std::string& name)
+    {
+        indexchain(id, KIND_VALUE, _sidecar ? _sidecar->firstvalue(id) : _hv.firstvalue(id));
+        return lookup(id, KIND_VALUE, name);
+    }
+
+    // find the key at path, returns 0 when not found.
+    // parentpath receives the path of the parent key, as stored in the hive.
+    uint32_t findkey(const RegistryPath& path, std::string *parentpath= NULL)
+    {
+        int root= int(path.GetRoot())&255;
+        if (root>=8 || path.GetPath().empty())
+            return 0;
+        if (_sidecar && root<=ent::HKLM)
+            return findkeyinsidecar(root, path.GetPath(), parentpath);
+
+        uint32_t parent= ROOTPARENT+root;
+        uint32_t id= 0;
+
+        std::string p= path.GetPath();
+        size_t start= 0;
+        while (true)
+        {
+            size_t end= p.find('\\', start);
+            if (end==p.npos)
+                end= p.size();
+
+            if (id && parentpath) {
+                *parentpath += "\\";
+                *parentpath += _hv.name(id);
+            }
+            id= findchild(parent, p.substr(start, end-start));
+            if (!id)
+                return 0;
+            if (end==p.size())
+                return id;
+
+            parent= id;
+            start= end+1;
+        }
+    }
+private:
+    // the sidecar has all key paths, check the candidates name by name, up to the root
+    uint32_t findkeyinsidecar(int root, const std::string& p, std::string *parentpath)
+    {
+        auto matches= [&](uint32_t id) {
+            size_t end= p.size();
+            for (uint32_t k= id ; k && end ; k= _sidecar->parent(k)) {
+                size_t start= p.rfind('\\', end-1);
+                start= start==p.npos ? 0 : start+1;
+                if (!_hv.iskey(k) || !foldednameequal(_hv.name(k), p.substr(start, end-start)))
+                    return false;
+                if (start==0)
+                    return _sidecar->parent(k)==0;
+                end= start-1;
+            }
+            return false;
+        };
+        uint32_t id= _sidecar->findkey(root, p, matches);
+        if (id && parentpath) {
+            std::vector<uint32_t> keys;
+            for (uint32_t k= _sidecar->parent(id) ; k ; k= _sidecar->parent(k))
+                keys.push_back(k);
+            for (auto i= keys.rbegin() ; i!=keys.rend() ; ++i) {
+                *parentpath += "\\";
+                *parentpath += _hv.name(*i);
+            }
+        }
+        return id;
+    }
+};
+
+class dumper {
+protected:
+    hivesource& tab;
+    keyindex index;
+    outputbuffer& out;
+
+    // entries already dumped, a corrupted hive may link back to an earlier entry
+    std::vector<bool> _visited;
+
+    // the key traversal stack: the next key to dump on each level, and the length
+    // of the path of its parent in _path
+    struct level {
+        uint32_t id;
+        size_t pathlen;
+        level(uint32_t id, size_t pathlen) : id(id), pathlen(pathlen) { }
+    };
+    std::vector<level> _stack;
+    std::string _path;
+
+    void resetvisited()
+    {
+        _visited.assign(_visited.size(), false);
+    }
+    // returns false when id was already visited
+    bool visit(uint32_t id)
+    {
+        if (id>=_visited.size())
+            _visited.resize(std::max(size_t(id)+1, _visited.size()*2));
+        if (_visited[id])
+            return false;
+        _visited[id]= true;
+        return true;
+    }
+public:
+    dumper(hivesource& tab, outputbuffer& out) : tab(tab), index(tab), out(out) { }
+    virtual ~dumper() { }
+
+    void usesidecar(const hiveindexfile *idx) { index.usesidecar(idx); }
+
+    void dumpvalues(uint32_t id)
+    {
+        while (id)
+        {
+            if (!tab.isvalue(id)) {
+                out.format("WARN: [%08x] is not a value\n", id);
+                return;
+            }
+            if (!visit(id)) {
+                out.format("WARN: [%08x] was already visited\n", id);
+                return;
+            }
+            {
+                STATS_STEP(OUTPUT);
+                dumpvalue(id);
+            }
+            id= tab.nextvalue(id);
+        }
+    }
+    virtual void dumpvalue(uint32_t id)= 0;
+
+    // dump key id and its subkeys, and when siblings is set, all its next siblings.
+    // the traversal uses an explicit stack, so deep trees don't overflow the
+    // native stack, and visits each entry at most once.
+    void dumpkeys(uint32_t id, const std::string& path, bool siblings= true)
+    {
+        _path= path;
+        _stack.clear();
+        _stack.push_back(level(id, _path.size()));
+        while (!_stack.empty())
+        {
+            level& cur= _stack.back();
+            id= cur.id;
+            _path.resize(cur.pathlen);
+            if (!id) {
+                _stack.pop_back();
+                continue;
+            }
+            if (!tab.iskey(id)) {
+                out.format("WARN: [%08x] is not a key\n", id);
+                _stack.pop_back();
+                continue;
+            }
+            if (!visit(id)) {
+                out.format("WARN: [%08x] was already visited\n", id);
+                _stack.pop_back();
+                continue;
+            }
+            cur.id= (siblings || _stack.size()>1) ? tab.nextsibling(id) : 0;
+
+            {
+                STATS_STEP(OUTPUT);
+                dumpkey(id, _path);
+            }
+            dumpvalues(tab.firstvalue(id));
+
+            _path += '\\';
+            _path += tab.name(id);
+            _stack.push_back(level(tab.firstchild(id), _path.size()));
+        }
+    }
+    virtual void dumpkey(uint32_t id, const std::string& path)= 0;
+
+    // dump a single key with all its values and subkeys
+    void dumpsubtree(uint32_t id, const std::string& path)
+    {
+        dumpkeys(id, path, false);
+    }
+    void dumproot()            
+    {
+        if (!tab.hasroots() || tab.rootsid()!=0) {
+            out.append("could not find root\n");
+            return;
+        }
+        resetvisited();
+        dumproots();
+
+        dumpkeys(tab.hiveid(ent::HKCR), "HKCR");
+        dumpkeys(tab.hiveid(ent::HKCU), "HKCU");
+        dumpkeys(tab.hiveid(ent::HKLM), "HKLM");
+    }
+    // dump only the subtree at keyspec
+    void dumppath(const std::string& keyspec)
+    {
+        if (!tab.hasroots() || tab.rootsid()!=0) {
+            out.append("could not find root\n");
+            return;
+        }
+        RegistryPath path= RegistryPath::FromKeySpec(keyspec);
+        int root= int(path.GetRoot())&255;
+        if (root>=8)
+            throw stringformat("unsupported root: %s", keyspec.c_str());
+
+        resetvisited();
+        if (path.GetPath().empty()) {
+            dumproots();
+            dumpkeys(tab.hiveid(root), path.GetRootName());
+            return;
+        }
+        std::string parentpath= path.GetRootName();
+        uint32_t id= index.findkey(path, &parentpath);
+        if (!id)
+            throw stringformat("key not found: %s", keyspec.c_str());
+
+        dumproots();
+        dumpsubtree(id, parentpath);
+    }
+
+    // print a single key with its values, or a single value.
+    // query is KEYPATH or KEYPATH:VALUENAME, returns false when not found.
+    // the first ':' ends the key path, so value names may contain '\\'.
+    bool query(const std::string& query)
+    {
+        std::string keyspec= query;
+        std::string valuename;
+        size_t colon= query.find(':');
+        if (colon!=query.npos) {
+            keyspec= query.substr(0, colon);
+            valuename= query.substr(colon+1);
+        }
+        RegistryPath path= RegistryPath::FromKeySpec(keyspec);
+        std::string parentpath= path.GetRootName();
+        uint32_t id= index.findkey(path, &parentpath);
+        uint32_t valid= 0;
+        if (id && colon!=query.npos)
+            valid= index.findvalue(id, valuename=="@" ? "Default" : valuename);
+        if (!id || (colon!=query.npos && !valid)) {
+            out.format("; not found: %s\n", query.c_str());
+            return false;
+        }
+
+        resetvisited();
+        dumpkeyheader(id, parentpath);
+        if (valid)
+            dumpvalue(valid);
+        else
+            dumpvalues(tab.firstvalue(id));
+        return true;
+    }
+    // the key line before the query results
+    virtual void dumpkeyheader(uint32_t id, const std::string& path)
+    {
+        dumpkey(id, path);
+    }
+    virtual void dumproots()= 0;
+};
+class rawdumper : public dumper {
+public:
+    rawdumper(hivesource& tab, outputbuffer& out) : dumper(tab, out) { }
+    virtual void dumpvalue(uint32_t id)
+    {
+        out.append('[');
+        out.hex32(id);
+        out.append("]         n:", 12);
+        out.hex32(tab.nextvalue(id));
+        out.append(' ');
+        out.appendpadded(tab.name(id), 64);
+        out.append("  ", 2);
+        tab.writevalue(out, id);
+        out.append('\n');
+    }
+    virtual void dumpkey(uint32_t id, const std::string& path)
+    {
+        out.format("[%08x] KEY S:%08x C:%08x V:%08x %s\n", id, tab.nextsibling(id), tab.firstchild(id), tab.firstvalue(id), tab.name(id));
+    }
+    virtual void dumproots()
+    {
+        out.format("[%08d]   hkcr:[%08x], hkcu:[%08x], hklm:[%08x]\n", tab.rootsid(), tab.hiveid(ent::HKCR), tab.hiveid(ent::HKCU), tab.hiveid(ent::HKLM));
+    }
+
+};
+class regdumper : public dumper {
+public:
+    regdumper(hivesource& tab, outputbuffer& out) : dumper(tab, out) { }
+
+    virtual void dumpvalue(uint32_t id)
+    {
+        const char *name= tab.name(id);
+        if (strcmp(name, "Default")==0)
+            out.append(" @=", 3);
+        else {
+            out.append(" \"", 2);
+            out.append(name);
+            out.append("\"=", 2);
+        }
+        tab.writevalue(out, id);
+        out.append('\n');
+    }
+    virtual void dumpkey(uint32_t id, const std::string& path)
+    {
+        if (tab.firstvalue(id) || !tab.firstchild(id))
+            dumpkeyheader(id, path);
+    }
+    virtual void dumpkeyheader(uint32_t id, const std::string& path)
+    {
+        out.append("\n[", 2);
+        out.append(path);
+        out.append('\\');
+        out.append(tab.name(id));
+        out.append("]\n", 2);
+    }
+    virtual void dumproots()
+    {
+        out.append("REGEDIT4\n");
+    }
+};
+
+// writes the keys and values passed to it as .reg text, formatted as by regdumper.
+// values are encoded as in a hive, so parsing the output gives the same values.
+class regwriter : public regkeymaker {
+    outputbuffer& _out;
+public:
+    regwriter(outputbuffer& out)
+        : _out(out)
+    {
+        _out.append("REGEDIT4\n");
+    }
+    virtual void newkey(const RegistryPath& path)
+    {
+        _out.append("\n[", 2);
+        _out.append(path.GetRootName());
+        _out.append('\\');
+        _out.append(path.GetPath());
+        _out.append("]\n", 2);
+    }
+    virtual void setval(const std::string& name, const RegistryValue& value)
+    {
+        if (name=="Default" || name=="@")
+            _out.append(" @=", 3);
+        else {
+            _out.append(" \"", 2);
+            _out.append(name);
+            _out.append("\"=", 2);
+        }
+        ent::value_ptr v= HvFile::makevalue(0, name, value);
+        ByteVector data;
+        v->encodeasbinary(data);
+        ent::writevalue(_out, v->valuetype(), data.data(), data.size());
+        _out.append('\n');
+    }
+};
+#endif
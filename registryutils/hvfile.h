@@ -0,0 +1,1892 @@
+#ifndef _HV_FILE_H_
+#define _HV_FILE_H_
+// the hv/vol hive file format: the entry codecs in namespace ent, the
+// decoded hive table, lazy entry access, and HvFile, which reads and
+// writes hive images. shared by hvtool, hvbench and hvgen.
+#include "util/ReadWriter.h"
+#include "util/rw/MemoryReader.h"
+#include "crypto/hash.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include "vectorutils.h"
+#include "util/chariterators.h"
+#include <memory>
+#include <functional>
+#include <map>
+#include <array>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <algorithm>
+#include <cinttypes>
+#include "regpath.h"
+#include "regvalue.h"
+#include "regfileparser.h"
+#include "phasestats.h"
+#include "utfconvert.h"
+
+// verbosity of the decoder warnings, set by -v
+inline int g_verbose;
+
+template<typename PTR>
+size_t vectorread32le(PTR rd, DwordVector& v, size_t n)
+{
+    v.resize(n);
+
+    size_t nr= rd->read((uint8_t*)&v[0], n*sizeof(uint32_t));
+    if (nr%sizeof(uint32_t))
+        throw "read partial uint32_t";
+    v.resize(nr/sizeof(uint32_t));
+#if __BYTE_ORDER == __BIG_ENDIAN
+#ifdef __GXX_EXPERIMENTAL_CXX0X__
+    std::for_each(v.begin(), v.end(), [](uint32_t& x) { x= swab32(x);});
+#else
+    throw "need c++0x";
+#endif
+#endif
+    return v.size();
+}
+
+template<typename PTR>
+size_t vectorread8(PTR rd, ByteVector& v, size_t n)
+{
+	v.resize(n);
+	size_t nr= rd->read((uint8_t*)&v[0], n);
+	v.resize(nr);
+	return v.size();
+}
+// convert a utf-16le string of (at most) n WCHARs, stored in memory, to utf-8,
+// appending to str. the string ends at the first NUL.
+inline void decodeutf16le(const uint8_t *p, size_t n, std::string& str)
+{
+    size_t len= 0;
+    while (len<n && (p[2*len] || p[2*len+1]))
+        len++;
+    utf16toutf8(p, len*sizeof(uint16_t), false, true, str);
+}
+inline std::string decodeutf16le(const uint8_t *p, size_t n)
+{
+    std::string str;
+    decodeutf16le(p, n, str);
+    return str;
+}
+
+// key and value names are compared case insensitive, as in windows.
+// note: only ascii letters are folded.
+inline uint64_t foldednamehash(std::string_view name)
+{
+    // fnv-1a over the folded name
+    uint64_t h= 0xcbf29ce484222325ULL;
+    for (auto c : name) {
+        h ^= (uint8_t)tolower((uint8_t)c);
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+inline bool foldednameequal(std::string_view a, std::string_view b)
+{
+    if (a.size()!=b.size())
+        return false;
+    for (size_t i=0 ; i<a.size() ; i++)
+        if (tolower((uint8_t)a[i])!=tolower((uint8_t)b[i]))
+            return false;
+    return true;
+}
+
+// formats the dump output into a large buffer, which is written out with
+// a single fwrite when full.
+class outputbuffer {
+    FILE *_f;
+    std::vector<char> _buf;
+    size_t _len;
+
+    static const char *hexdigits() { return "0123456789abcdef"; }
+public:
+    // an empty filename writes to stdout
+    outputbuffer(const std::string& filename, size_t size= 0x100000)
+        : _f(stdout), _buf(size), _len(0)
+    {
+        if (!filename.empty()) {
+            _f= fopen(filename.c_str(), "wb");
+            if (_f==NULL)
+                throw stringformat("%s: %s", filename.c_str(), strerror(errno));
+        }
+    }
+    ~outputbuffer()
+    {
+        STATS_STEP(OUTPUT);
+        STATS_BYTES(OUTPUT, _len);
+        if (_len)
+            fwrite(&_buf[0], 1, _len, _f);
+        if (_f==stdout)
+            fflush(_f);
+        else
+            fclose(_f);
+    }
+    void flush()
+    {
+        STATS_STEP(OUTPUT);
+        STATS_BYTES(OUTPUT, _len);
+        if (_len && fwrite(&_buf[0], 1, _len, _f)!=_len)
+            throw stringformat("write: %s", strerror(errno));
+        _len= 0;
+        fflush(_f);
+    }
+    // returns space for at least n chars, followed by commit(nr used)
+    char *reserve(size_t n)
+    {
+        if (_len+n > _buf.size()) {
+            flush();
+            if (n > _buf.size())
+                _buf.resize(n);
+        }
+        return &_buf[_len];
+    }
+    void commit(size_t n) { _len += n; }
+
+    void append(char c)
+    {
+        *reserve(1)= c;
+        commit(1);
+    }
+    void append(const char *p, size_t n)
+    {
+        memcpy(reserve(n), p, n);
+        commit(n);
+    }
+    void append(const char *str) { append(str, strlen(str)); }
+    void append(const std::string& str) { append(str.data(), str.size()); }
+
+    // append str, padded with spaces to width
+    void appendpadded(const char *str, size_t width)
+    {
+        size_t n= strlen(str);
+        append(str, n);
+        if (n<width) {
+            memset(reserve(width-n), ' ', width-n);
+            commit(width-n);
+        }
+    }
+    void format(const char *fmt, ...)
+    {
+        va_list ap;
+        va_start(ap, fmt);
+        int n= vsnprintf(reserve(256), 256, fmt, ap);
+        va_end(ap);
+        if (n>=256) {
+            // too large for the reserved space, format again
+            va_start(ap, fmt);
+            vsnprintf(reserve(n+1), n+1, fmt, ap);
+            va_end(ap);
+        }
+        commit(n);
+    }
+
+    void hex8(uint8_t b)
+    {
+        char *p= reserve(2);
+        p[0]= hexdigits()[b>>4];
+        p[1]= hexdigits()[b&15];
+        commit(2);
+    }
+    void hex32(uint32_t v)
+    {
+        char *p= reserve(8);
+        for (int i=7 ; i>=0 ; i--, v>>=4)
+            p[i]= hexdigits()[v&15];
+        commit(8);
+    }
+    // same as hexstring(data, n, sep)
+    void hexbytes(const uint8_t *data, size_t n, char sep)
+    {
+        char *p= reserve(n*3);
+        char *q= p;
+        for (size_t i=0 ; i<n ; i++) {
+            if (i && sep)
+                *q++ = sep;
+            *q++ = hexdigits()[data[i]>>4];
+            *q++ = hexdigits()[data[i]&15];
+        }
+        commit(q-p);
+    }
+
+    // same as cstrescape(str), plain chars are copied directly,
+    // other chars are escaped by cstrescape.
+    void escaped(const char *str, size_t n)
+    {
+        size_t i= 0;
+        while (i<n) {
+            size_t plain= i;
+            while (i<n && str[i]>=0x20 && str[i]<0x7f && str[i]!='"' && str[i]!='\\')
+                i++;
+            append(str+plain, i-plain);
+            if (i==n)
+                break;
+            if (str[i]=='"' || str[i]=='\\') {
+                char *p= reserve(2);
+                p[0]= '\\';
+                p[1]= str[i++];
+                commit(2);
+                continue;
+            }
+            size_t special= i;
+            while (i<n && !(str[i]>=0x20 && str[i]<0x7f))
+                i++;
+            append(cstrescape(std::string(str+special, i-special)));
+        }
+    }
+    void escaped(const std::string& str) { escaped(str.data(), str.size()); }
+
+    // escape a utf-16le string of at most n WCHARs, ending at the first NUL.
+    // ascii strings are escaped directly from the hive image.
+    void escapedutf16le(const uint8_t *p, size_t n)
+    {
+        for (size_t i=0 ; i<n ; i++) {
+            uint16_t w= p[2*i] | (p[2*i+1]<<8);
+            if (w==0)
+                return;
+            if (w>=0x80) {
+                escaped(decodeutf16le(p+2*i, n-i));
+                return;
+            }
+            char c= w;
+            if (c>=0x20 && c<0x7f && c!='"' && c!='\\')
+                append(c);
+            else
+                escaped(&c, 1);
+        }
+    }
+};
+
+namespace ent {
+
+class base;
+typedef std::shared_ptr<base> entry_ptr;
+    class roots;
+    class key;
+    class value;
+    class database;
+    class record;
+    class recordmore;
+    class index;
+    class volume;
+
+    class stringvalue;
+    class binaryvalue;
+    class dwordvalue;
+    class stringlistvalue;
+    class muistringvalue;
+
+// a name or string payload:
+//   either a utf-16le string in the hive image, only converted when asked for,
+//   or a utf-8 string, for entries created by the hvmaker.
+class wstrview {
+    const uint8_t *_p;
+    size_t _n;          // nr of WCHARs at _p
+    std::string _str;
+public:
+    wstrview()
+        : _p(NULL), _n(0)
+    {
+    }
+    wstrview(const std::string& str)
+        : _p(NULL), _n(0), _str(str)
+    {
+    }
+    wstrview(const uint8_t *p, size_t n)
+        : _p(p), _n(n)
+    {
+    }
+    std::string str() const
+    {
+        if (_p)
+            return decodeutf16le(_p, _n);
+        return _str;
+    }
+    // case insensitive compare with a utf-8 name, without converting when
+    // the utf-16 string is plain ascii.
+    bool foldedequal(std::string_view name) const
+    {
+        if (!_p)
+            return foldednameequal(_str, name);
+        for (size_t i=0 ; i<_n ; i++) {
+            uint16_t c= _p[2*i] | (_p[2*i+1]<<8);
+            if (c>=0x80)
+                return foldednameequal(str(), name);
+            if (i>=name.size() || tolower(c)!=tolower((uint8_t)name[i]))
+                return false;
+        }
+        return _n==name.size();
+    }
+};
+
+// entries decoded from a hive image don't own their data, they keep a view
+// into the image, which must stay valid for the lifetime of the entry.
+class base : public MemoryReader {
+    uint32_t _id;  // note: this id is not orred with 0x20000000
+protected:
+    const uint8_t *_data;
+    size_t _size;
+
+    // ptr to the current read position
+    const uint8_t *curptr() { return _data+getpos(); }
+    // nr of bytes left after the current read position
+    size_t remaining() { return getpos()<_size ? _size-getpos() : 0; }
+public:
+    base(uint32_t id)
+        : _id(id), _data(NULL), _size(0)
+    {
+    }
+    base(uint32_t id, const uint8_t *data, size_t size)
+        : _id(id), _data(data), _size(size)
+    {
+        setbuf(data, size);
+    }
+    virtual uint16_t entrytype()= 0;
+    virtual const char*typestr()=0;
+    static entry_ptr readentry(const uint8_t *p, size_t maxsize, uint32_t ofs, uint8_t flag);
+
+    uint32_t id() { return _id&0x0fffffff; }
+
+    // append the encoded entry to out
+    virtual void save(ByteVector& out)= 0;
+
+    roots* asroots();
+    key* askey();
+    value* asvalue();
+
+    void savehead(ByteVector& out, uint32_t savesize)
+    {
+        BV_AppendDword(out, (entrytype()<<28) | savesize);
+        BV_AppendDword(out, 0);
+        BV_AppendDword(out, _id);
+    }
+};
+    enum { HKCR, HKCU, HKLM, HKU };
+    enum {
+        ET_DATABASE=7,
+        ET_RECORD,  // 8
+        ET_RECMORE, // 9
+        ET_VOLUME,  // a
+        ET_ROOTS,   // b
+        ET_KEY,     // c
+        ET_VALUE,   // d
+        ET_INDEX    // e
+    };
+
+// type 0xb000  - have ptrs, contains pointers to start fo HKCR, HKCU, HKLM
+class roots : public base {
+    std::vector<uint32_t> _roots;
+    std::vector<uint32_t> _lasts;
+public:
+    roots(uint32_t id)
+        : base(id)
+    {
+        _roots.resize(8);
+        _lasts.resize(8);
+    }
+    roots(uint32_t id, const uint8_t *data, size_t size)
+        : base(id, data, size)
+    {
+        vectorread32le(this, _roots, 8);
+        _lasts.resize(8); // note: not updated
+        auto i= std::find_if(_roots.begin()+3, _roots.end(), [](uint32_t x) { return x!=0; });
+        if (i!=_roots.end())
+            printf("WARNING: more roots: %s\n", hexdump(&_roots[3], 5).c_str());
+
+    }
+    virtual uint16_t entrytype() { return ET_ROOTS; }
+
+    uint32_t hiveid(HKEY root)
+    {
+        return _roots[int(root)&255]&0x0fffffff;
+    }
+    void hiveid(HKEY root, uint32_t id)
+    {
+        _roots[int(root)&255]= id|0x20000000;
+    }
+    uint32_t lasthivekey(HKEY root)
+    {
+        return _lasts[int(root)&255]&0x0fffffff;
+    }
+    void lasthivekey(HKEY root, uint32_t id)
+    {
+        _lasts[int(root)&255]= id|0x20000000;
+    }
+
+
+    virtual const char*typestr() { return "roots"; }
+
+    virtual void save(ByteVector& out)
+    {
+        savehead(out, _roots.size()*sizeof(uint32_t));
+        for (auto id : _roots)
+            BV_AppendDword(out, id);
+    }
+};
+
+// type 0xc000  - ptr to next sibling, first child, first value, name
+class key : public base {
+    uint32_t _nextsibling;
+    uint32_t _firstchild;
+    uint32_t _firstvalue;
+    uint32_t _lastvalue;   // not stored, just for easy tree building
+    uint32_t _lastchild;   // not stored, just for easy tree building
+    wstrview _name;
+public:
+    key(uint32_t id, const std::string& name)
+        : base(id), _nextsibling(0), _firstchild(0), _firstvalue(0), _lastvalue(0), _lastchild(0), _name(name)
+    {
+    }
+    key(uint32_t id, const uint8_t *data, size_t size)
+        : base(id, data, size)
+    {
+        _nextsibling= read32le();
+        _firstchild= read32le();
+        _firstvalue= read32le();
+
+        // note: when reading these are not updated!!
+        _lastvalue= 0;
+        _lastchild= 0;
+
+        uint8_t namlen= read8();  // max 0x44
+        /*uint8_t unusedlen=*/ read8();  // max 0x61
+        uint16_t flags= read16le();
+        if (flags && g_verbose)
+            printf("WARNING: key flags=%04x\n", flags);
+
+        _name= wstrview(curptr(), std::min(size_t(namlen), remaining()/sizeof(uint16_t)));
+    }
+    virtual uint16_t entrytype() { return ET_KEY; }
+    virtual const char*typestr() { return "key"; }
+    std::string name() { return _name.str(); }
+    bool nameequal(std::string_view name) { return _name.foldedequal(name); }
+    uint32_t nextsibling() { return _nextsibling&0x0fffffff; }
+    void nextsibling(uint32_t id) { _nextsibling= id ? (id|0x20000000) : 0; }
+    uint32_t firstchild() { return _firstchild&0x0fffffff; }
+    void firstchild(uint32_t id) { _firstchild= id ? (id|0x20000000) : 0; }
+    uint32_t firstvalue() { return _firstvalue&0x0fffffff; }
+    void firstvalue(uint32_t id) { _firstvalue= id ? (id|0x20000000) : 0; }
+
+    uint32_t lastvalue() { return _lastvalue&0x0fffffff; }
+    void lastvalue(uint32_t id) { _lastvalue= id ? (id|0x20000000) : 0; }
+    uint32_t lastchild() { return _lastchild&0x0fffffff; }
+    void lastchild(uint32_t id) { _lastchild= id ? (id|0x20000000) : 0; }
+
+
+    virtual void save(ByteVector& out)
+    {
+        ByteVector wname;
+        utf8toutf16le(name(), wname);
+        size_t namlen= wname.size()/sizeof(WCHAR);
+        size_t padding= (namlen&1) ? 2 : 0;
+        savehead(out, 16 + wname.size()+padding);
+        BV_AppendDword(out, _nextsibling);
+        BV_AppendDword(out, _firstchild);
+        BV_AppendDword(out, _firstvalue);
+        out.push_back(namlen);
+        out.push_back(0);
+        BV_AppendWord(out, 0);
+
+        out.insert(out.end(), wname.begin(), wname.end());
+
+        if (padding)
+            BV_AppendWord(out, 0);
+    }
+
+};
+
+//=============================================================================
+// type 0xd000 - value
+class value;
+typedef std::shared_ptr<value> value_ptr;
+
+enum { VT_STRING=1, VT_BINARY=3, VT_DWORD=4, VT_STRINGLIST=7, VT_MUI=21 };
+inline bool isknownvaluetype(uint16_t type)
+{
+    return type==VT_STRING || type==VT_BINARY || type==VT_DWORD || type==VT_STRINGLIST || type==VT_MUI;
+}
+
+void writevalue(outputbuffer& o, uint16_t type, const uint8_t *data, size_t size);
+
+class value : public base {
+    uint32_t _nextvalue;
+    wstrview _name;
+public:
+    value(uint32_t id, const std::string& name)
+        : base(id), _nextvalue(0), _name(name)
+    {
+    }
+    value(uint32_t id, uint32_t next, const wstrview& name, const uint8_t *data, size_t size)
+        : base(id, data, size), _nextvalue(next), _name(name)
+    {
+    }
+    uint32_t nextvalue() { return _nextvalue&0x0fffffff; }
+    void nextvalue(uint32_t id) { _nextvalue= id ? (id|0x20000000) : 0; }
+
+    virtual uint16_t entrytype() { return ET_VALUE; }
+    virtual uint16_t valuetype()= 0;
+    static value_ptr readvalue(uint32_t id, const uint8_t *data, size_t size);
+    virtual const char*typestr() { return "value"; }
+    virtual std::string asstring()= 0;
+    std::string name() const { return _name.str(); }
+
+    // format as asstring does, into the output buffer
+    void writeto(outputbuffer& o)
+    {
+        if (_data)
+            writevalue(o, valuetype(), _data, _size);
+        else
+            o.append(asstring());
+    }
+
+    virtual void encodeasbinary(ByteVector& bin)= 0;
+
+    virtual void save(ByteVector& out)
+    {
+        ByteVector wname;
+        utf8toutf16le(name(), wname);
+        ByteVector bin;
+        encodeasbinary(bin);
+
+        size_t datasize= 10 + wname.size()+bin.size();
+        size_t padding= (datasize&3) ? 4-(datasize&3) : 0;
+        savehead(out, 10 + wname.size()+bin.size()+padding);
+
+        BV_AppendDword(out, _nextvalue);
+        BV_AppendWord(out, valuetype());
+        BV_AppendWord(out, bin.size());
+        BV_AppendWord(out, wname.size()/sizeof(WCHAR));
+
+        out.insert(out.end(), wname.begin(), wname.end());
+        out.insert(out.end(), bin.begin(), bin.end());
+
+        out.resize(out.size()+padding);
+    }
+};
+class stringvalue : public value {
+    wstrview _value;
+public:
+    stringvalue(uint32_t id, const std::string& name, const std::string& data)
+        : value(id, name), _value(data)
+    {
+    }
+    stringvalue(uint32_t id, uint32_t next, const wstrview& name, const uint8_t *data, size_t size)
+        : value(id, next, name, data, size), _value(data, size/2)
+    {
+    }
+    virtual uint16_t valuetype() { return VT_STRING; }
+    std::string str()
+    {
+        return _value.str();
+    }
+    virtual std::string asstring()
+    {
+        return "\""+cstrescape(str())+"\"";
+    }
+    virtual void encodeasbinary(ByteVector& bin)
+    {
+        utf8toutf16le(str(), bin);
+        BV_AppendWord(bin, 0);
+    }
+};
+class binaryvalue : public value {
+    ByteVector _value;      // only used for values created by the hvmaker
+public:
+    binaryvalue(uint32_t id, const std::string& name, const ByteVector& data)
+        : value(id, name), _value(data)
+    {
+    }
+    binaryvalue(uint32_t id, uint32_t next, const wstrview& name, const uint8_t *data, size_t size)
+        : value(id, next, name, data, size)
+    {
+    }
+    virtual uint16_t valuetype() { return VT_BINARY; }
+
+    // decoded values point into the hive image
+    const uint8_t *binptr() { return _data ? _data : _value.data(); }
+    size_t binsize() { return _data ? _size : _value.size(); }
+    ByteVector bin()
+    {
+        return ByteVector(binptr(), binptr()+binsize());
+    }
+    virtual std::string asstring()
+    {
+        return "hex:"+hexstring(binptr(), binsize(),',');
+    }
+    virtual void encodeasbinary(ByteVector& bin)
+    {
+        bin.assign(binptr(), binptr()+binsize());
+    }
+};
+class dwordvalue : public value {
+    uint32_t _value;
+public:
+    dwordvalue(uint32_t id, const std::string& name, uint32_t data)
+        : value(id, name), _value(data)
+    {
+    }
+    dwordvalue(uint32_t id, uint32_t next, const wstrview& name, const uint8_t *data, size_t size)
+        : value(id, next, name, data, size)
+    {
+        _value= read32le();
+    }
+    virtual uint16_t valuetype() { return VT_DWORD; }
+    uint32_t dword()
+    {
+        return _value;
+    }
+    virtual std::string asstring()
+    {
+        return stringformat("dword:%08x", _value);
+    }
+    virtual void encodeasbinary(ByteVector& bin)
+    {
+        BV_AppendDword(bin, _value);
+    }
+};
+class stringlistvalue : public value {
+    StringList _value;      // only used for values created by the hvmaker
+public:
+    stringlistvalue(uint32_t id, const std::string& name, const StringList& data)
+        : value(id, name), _value(data)
+    {
+    }
+    stringlistvalue(uint32_t id, uint32_t next, const wstrview& name, const uint8_t *data, size_t size)
+        : value(id, next, name, data, size)
+    {
+    }
+    virtual uint16_t valuetype() { return VT_STRINGLIST; }
+    StringList list()
+    {
+        if (!_data)
+            return _value;
+
+        // decode the list from the hive image
+        StringList list;
+        size_t start= 0;
+        for (size_t i=0 ; i<_size/2 ; i++)
+        {
+            if (get16le(_data+2*i)==0) {
+                list.push_back(decodeutf16le(_data+2*start, i-start));
+                start= i+1;
+            }
+        }
+        if (!list.empty() && list.back().empty())
+            list.resize(list.size()-1);
+        return list;
+    }
+    virtual std::string asstring()
+    {
+        StringList l= list();
+        std::string str;
+        for (StringList::const_iterator i=l.begin() ; i!=l.end() ; ++i)
+        {
+            if (!str.empty())
+                str += ", ";
+            str += "\"" + cstrescape(*i) + "\"";
+        }
+        return "multi_sz:"+str;
+    }
+    virtual void encodeasbinary(ByteVector& bin)
+    {
+        StringList l= list();
+        for (StringList::const_iterator i= l.begin() ; i!=l.end() ; ++i)
+        {
+            utf8toutf16le(*i, bin);
+            BV_AppendWord(bin, 0); // add terminating (WCHAR)NUL
+        }
+        BV_AppendWord(bin, 0); // add terminating (WCHAR)NUL
+    }
+};
+class muistringvalue : public value {
+    wstrview _value;
+public:
+    muistringvalue(uint32_t id, const std::string& name, const std::string& data)
+        : value(id, name), _value(data)
+    {
+    }
+    muistringvalue(uint32_t id, uint32_t next, const wstrview& name, const uint8_t *data, size_t size)
+        : value(id, next, name, data, size), _value(data, size/2)
+    {
+    }
+    virtual uint16_t valuetype() { return VT_MUI; }
+    std::string muistr()
+    {
+        return _value.str();
+    }
+    virtual std::string asstring()
+    {
+        return "mui_sz:\""+cstrescape(muistr())+"\"";
+    }
+    virtual void encodeasbinary(ByteVector& bin)
+    {
+         utf8toutf16le(muistr(), bin);
+    }
+};
+inline value_ptr value::readvalue(uint32_t id, const uint8_t *data, size_t size)
+{
+    MemoryReader r(data, size);
+    uint32_t nextvalue= r.read32le();
+    uint16_t type= r.read16le();   // 1, 3, 4, 7, 21
+    uint16_t vallen= r.read16le();  // max 0xc5a
+    uint16_t namlen= r.read16le();  // max 0x75
+
+    // name and value are clipped to the entry size
+    size_t ofs= r.getpos();
+    size_t namsize= std::min(size_t(namlen)*sizeof(uint16_t), size-ofs);
+    wstrview name(data+ofs, namsize/sizeof(uint16_t));
+    ofs += namsize;
+
+    const uint8_t *valdata= data+ofs;
+    size_t valsize= std::min(size_t(vallen), size-ofs);
+
+    switch(type)
+    {
+        case VT_STRING: return value_ptr(new stringvalue(id, nextvalue, name, valdata, valsize));
+        case VT_BINARY: return value_ptr(new binaryvalue(id, nextvalue, name, valdata, valsize));
+        case VT_DWORD:  return value_ptr(new dwordvalue(id, nextvalue, name, valdata, valsize));
+        case VT_STRINGLIST: return value_ptr(new stringlistvalue(id, nextvalue, name, valdata, valsize));
+        case VT_MUI:    return value_ptr(new muistringvalue(id, nextvalue, name, valdata, valsize));
+        default:
+                        printf("WARNING: unsupported value type %d ( next:%08x name:%s, val:%s )\n", type, nextvalue, name.str().c_str(), vhexdump(ByteVector(valdata, valdata+valsize)).c_str());
+    }
+    return value_ptr();
+}
+
+//=============================================================================
+
+class database : public base {
+public:
+    database(uint32_t id, const uint8_t *data, size_t size)
+        : base(id, data, size)
+    {
+        // todo
+        printf("WARNING: database not implemented\n");
+    }
+    virtual uint16_t entrytype() { return ET_DATABASE; }
+    virtual const char*typestr() { return "database"; }
+    virtual void save(ByteVector& out) { throw "not implemented"; }
+};
+class record : public base {
+public:
+    record(uint32_t id, const uint8_t *data, size_t size)
+        : base(id, data, size)
+    {
+        printf("WARNING: record not implemented\n");
+    }
+    virtual uint16_t entrytype() { return ET_RECORD; }
+    virtual const char*typestr() { return "record"; }
+    virtual void save(ByteVector& out) { throw "not implemented"; }
+};
+class recordmore : public base {
+public:
+    recordmore(uint32_t id, const uint8_t *data, size_t size)
+        : base(id, data, size)
+    {
+        printf("WARNING: recordmore not implemented\n");
+    }
+    virtual uint16_t entrytype() { return ET_RECMORE; }
+    virtual const char*typestr() { return "recmore"; }
+    virtual void save(ByteVector& out) { throw "not implemented"; }
+};
+class index : public base {
+public:
+    index(uint32_t id, const uint8_t *data, size_t size)
+        : base(id, data, size)
+    {
+        printf("WARNING: index not implemented\n");
+    }
+    virtual uint16_t entrytype() { return ET_INDEX; }
+    virtual const char*typestr() { return "index"; }
+    virtual void save(ByteVector& out) { throw "not implemented"; }
+};
+class volume : public base {
+public:
+    volume(uint32_t id, const uint8_t *data, size_t size)
+        : base(id, data, size)
+    {
+        printf("WARNING: volume not implemented\n");
+    }
+    virtual uint16_t entrytype() { return ET_VOLUME; }
+    virtual const char*typestr() { return "volume"; }
+    virtual void save(ByteVector& out) { throw "not implemented"; }
+};
+
+
+inline roots* base::asroots() { return dynamic_cast<roots*>(this); }
+inline key* base::askey() { return dynamic_cast<key*>(this); }
+inline value* base::asvalue() { return dynamic_cast<value*>(this); }
+
+// decode the entry at p, maxsize is the nr of bytes available at p.
+// note: the entry data is not copied, the returned entry points into p.
+inline entry_ptr base::readentry(const uint8_t *p, size_t maxsize, uint32_t ofs, uint8_t flag)
+{
+    if (maxsize<12)
+        throw "truncated entry";
+    MemoryReader r(p, maxsize);
+    uint32_t size= r.read32le();
+    uint8_t type= size>>28;
+    size &= ~0xf0000000;
+    uint32_t nul_0004= r.read32le();
+    uint32_t id= r.read32le();
+    STATS_ENTRY(type);
+    if (nul_0004 && g_verbose)
+        printf("WARNING: entry +4=%08x\n", nul_0004);
+    const uint8_t *data= p+12;
+    size= std::min(size_t(size), maxsize-12);
+
+    if (g_verbose>1)
+        printf("%08x-%08x:[%02x] %06x %x [%08x] ", ofs, ofs+12+size, flag, size, type, id);
+    switch(type) {
+        case ET_DATABASE: return entry_ptr(new database(id, data, size));
+        case ET_RECORD  : return entry_ptr(new record(id, data, size));
+        case ET_RECMORE : return entry_ptr(new recordmore(id, data, size));
+        case ET_VOLUME  : return entry_ptr(new volume(id, data, size));
+        case ET_ROOTS   : return entry_ptr(new roots(id, data, size));
+        case ET_KEY     : return entry_ptr(new key(id, data, size));
+        case ET_VALUE   : return value::readvalue(id, data, size);
+        case ET_INDEX   : return entry_ptr(new index(id, data, size));
+        default:
+                     printf("WARNING: unknown entry type %d, id=[%08x], data: %s\n", type, id, vhexdump(ByteVector(data, data+size)).c_str());
+    }
+    return entry_ptr();
+}
+
+// format a value payload as in a .reg file.
+inline std::string valuestring(uint16_t type, const uint8_t *data, size_t size)
+{
+    switch(type)
+    {
+        case VT_STRING: return stringvalue(0, 0, wstrview(), data, size).asstring();
+        case VT_BINARY: return binaryvalue(0, 0, wstrview(), data, size).asstring();
+        case VT_DWORD:  return dwordvalue(0, 0, wstrview(), data, size).asstring();
+        case VT_STRINGLIST: return stringlistvalue(0, 0, wstrview(), data, size).asstring();
+        case VT_MUI:    return muistringvalue(0, 0, wstrview(), data, size).asstring();
+    }
+    return stringformat("hex(%d):", type)+hexstring(data, size, ',');
+}
+
+// format a value payload as in a .reg file, directly into the output buffer.
+// the output is the same as from valuestring.
+inline void writevalue(outputbuffer& o, uint16_t type, const uint8_t *data, size_t size)
+{
+    switch(type)
+    {
+        case VT_STRING:
+            o.append('"');
+            o.escapedutf16le(data, size/2);
+            o.append('"');
+            return;
+        case VT_BINARY:
+            o.append("hex:", 4);
+            o.hexbytes(data, size, ',');
+            return;
+        case VT_DWORD:
+            if (size<4)
+                break;
+            o.append("dword:", 6);
+            o.hex32(get32le(data));
+            return;
+        case VT_STRINGLIST:
+            if (size&1)
+                break;
+            {
+            // only NUL terminated strings are in the list, and an empty last string is dropped
+            size_t end= size/2;
+            while (end && get16le(data+2*end-2))
+                end--;
+            if (end && (end==1 || get16le(data+2*end-4)==0))
+                end--;
+
+            o.append("multi_sz:", 9);
+            size_t start= 0;
+            for (size_t i=0 ; i<end ; i++) {
+                if (get16le(data+2*i))
+                    continue;
+                if (start)
+                    o.append(", ", 2);
+                o.append('"');
+                o.escapedutf16le(data+2*start, i-start);
+                o.append('"');
+                start= i+1;
+            }
+            }
+            return;
+        case VT_MUI:
+            o.append("mui_sz:\"", 8);
+            o.escapedutf16le(data, size/2);
+            o.append('"');
+            return;
+        default:
+            o.format("hex(%d):", type);
+            o.hexbytes(data, size, ',');
+            return;
+    }
+    o.append(valuestring(type, data, size));
+}
+
+} // namespace
+
+//=============================================================================
+// id based access to the keys and values of a decoded hive
+struct hivesource {
+    virtual ~hivesource() { }
+
+    virtual bool iskey(uint32_t id)= 0;
+    virtual bool isvalue(uint32_t id)= 0;
+    virtual bool hasroots()= 0;
+
+    virtual uint32_t rootsid()= 0;
+    virtual uint32_t hiveid(int root)= 0;
+
+    // note: only valid until the next call on this hivesource
+    virtual const char *name(uint32_t id)= 0;
+    virtual uint32_t nextsibling(uint32_t id)= 0;
+    virtual uint32_t firstchild(uint32_t id)= 0;
+    virtual uint32_t firstvalue(uint32_t id)= 0;
+
+    virtual uint32_t nextvalue(uint32_t id)= 0;
+    virtual std::string valuestring(uint32_t id)= 0;
+    // same as valuestring, formatted into o
+    virtual void writevalue(outputbuffer& o, uint32_t id)= 0;
+};
+
+// flat, id indexed representation of a decoded hive, used for dumping.
+//
+// all columns are indexed by the entry id, names are stored as utf-8 in
+// one string pool, value payloads stay in the hive image.
+class hivetable : public hivesource {
+    const uint8_t *_image;
+
+    std::vector<uint8_t>  _entrytype;   // 0 for unused ids
+    std::vector<uint32_t> _next;        // key: next sibling, value: next value
+    std::vector<uint32_t> _firstchild;
+    std::vector<uint32_t> _firstvalue;
+    std::vector<uint32_t> _nameofs;     // offset into _strings
+    std::vector<uint16_t> _valuetype;
+    std::vector<uint32_t> _dataofs;     // value payload offset in _image
+    std::vector<uint16_t> _datasize;
+
+    std::string _strings;   // NUL terminated names
+
+    uint32_t _rootsid;
+    DwordVector _roots;
+
+public:
+    // the decoded records of one section, filled by decoderecord, possibly
+    // on a worker thread, and then added to the table by merge.
+    struct sectionbuf {
+        struct row {
+            uint32_t id;
+            uint8_t type;
+            uint32_t next;
+            uint32_t firstchild;
+            uint32_t firstvalue;
+            uint32_t nameofs;       // offset into strings
+            uint16_t valuetype;
+            uint32_t dataofs;
+            uint16_t datasize;
+        };
+        std::vector<row> rows;
+        std::string strings;
+        DwordVector roots;
+        std::string log;        // warnings and verbose output
+        std::string error;      // set when decoding failed
+    };
+
+private:
+    // add a name to the string pool of buf, returns its offset
+    static uint32_t addname(sectionbuf& buf, const uint8_t *p, size_t n)
+    {
+        uint32_t ofs= buf.strings.size();
+        decodeutf16le(p, n, buf.strings);
+        buf.strings += '\0';
+        return ofs;
+    }
+public:
+    // maxentries: the nr of id slots in the hive
+    hivetable(const uint8_t *image, uint32_t maxentries)
+        : _image(image), _rootsid(0)
+    {
+        _entrytype.resize(maxentries);
+        _next.resize(maxentries);
+        _firstchild.resize(maxentries);
+        _firstvalue.resize(maxentries);
+        _nameofs.resize(maxentries);
+        _valuetype.resize(maxentries);
+        _dataofs.resize(maxentries);
+        _datasize.resize(maxentries);
+    }
+
+    // decode the record at p into buf, see ent::base::readentry.
+    // this does not modify the table, so can be called from multiple threads.
+    void decoderecord(sectionbuf& buf, const uint8_t *p, size_t maxsize, uint32_t ofs, uint8_t flag) const
+    {
+        if (maxsize<12)
+            throw "truncated entry";
+        MemoryReader r(p, maxsize);
+        uint32_t size= r.read32le();
+        uint8_t type= size>>28;
+        size &= ~0xf0000000;
+        uint32_t nul_0004= r.read32le();
+        uint32_t id= r.read32le()&0x0fffffff;
+        size= std::min(size_t(size), maxsize-12);
+        const uint8_t *data= p+12;
+        STATS_ENTRY(type);
+
+        if (nul_0004 && g_verbose)
+            buf.log += stringformat("WARNING: entry +4=%08x\n", nul_0004);
+        if (g_verbose>1)
+            buf.log += stringformat("%08x-%08x:[%02x] %06x %x [%08x] ", ofs, ofs+12+size, flag, size, type, id);
+        switch(type) {
+            case ent::ET_ROOTS:
+            case ent::ET_KEY:
+            case ent::ET_VALUE:
+                break;
+            case ent::ET_DATABASE: buf.log += "WARNING: database not implemented\n"; return;
+            case ent::ET_RECORD:   buf.log += "WARNING: record not implemented\n"; return;
+            case ent::ET_RECMORE:  buf.log += "WARNING: recordmore not implemented\n"; return;
+            case ent::ET_VOLUME:   buf.log += "WARNING: volume not implemented\n"; return;
+            case ent::ET_INDEX:    buf.log += "WARNING: index not implemented\n"; return;
+            default:
+                buf.log += stringformat("WARNING: unknown entry type %d, id=[%08x], data: %s\n", type, id, vhexdump(ByteVector(data, data+size)).c_str());
+                return;
+        }
+        if (id>=_entrytype.size()) {
+            buf.log += stringformat("WARN: @%08x: entry id %08x out of range\n", ofs, id);
+            return;
+        }
+        MemoryReader e(data, size);
+        sectionbuf::row row= { id, type, 0, 0, 0, 0, 0, 0, 0 };
+        switch(type) {
+            case ent::ET_ROOTS:
+                vectorread32le(&e, buf.roots, 8);
+                buf.roots.resize(8);
+                if (std::find_if(buf.roots.begin()+3, buf.roots.end(), [](uint32_t x) { return x!=0; })!=buf.roots.end())
+                    buf.log += stringformat("WARNING: more roots: %s\n", hexdump(&buf.roots[3], 5).c_str());
+                break;
+            case ent::ET_KEY: {
+                row.next= e.read32le()&0x0fffffff;
+                row.firstchild= e.read32le()&0x0fffffff;
+                row.firstvalue= e.read32le()&0x0fffffff;
+                uint8_t namlen= e.read8();
+                e.read8();
+                uint16_t flags= e.read16le();
+                if (flags && g_verbose)
+                    buf.log += stringformat("WARNING: key flags=%04x\n", flags);
+                row.nameofs= addname(buf, data+e.getpos(), std::min(size_t(namlen), (size-e.getpos())/2));
+                break;
+            }
+            case ent::ET_VALUE: {
+                row.next= e.read32le()&0x0fffffff;
+                row.valuetype= e.read16le();
+                uint16_t vallen= e.read16le();
+                uint16_t namlen= e.read16le();
+                size_t pos= e.getpos();
+                size_t namsize= std::min(size_t(namlen)*sizeof(uint16_t), size-pos);
+                row.nameofs= addname(buf, data+pos, namsize/sizeof(uint16_t));
+                pos += namsize;
+                row.dataofs= data+pos-_image;
+                row.datasize= std::min(size_t(vallen), size-pos);
+                if (!ent::isknownvaluetype(row.valuetype))
+                    buf.log += stringformat("WARNING: unsupported value type %d ( next:%08x name:%s, val:%s )\n", row.valuetype, row.next, &buf.strings[row.nameofs], vhexdump(ByteVector(data+pos, data+pos+row.datasize)).c_str());
+                break;
+            }
+        }
+        buf.rows.push_back(row);
+    }
+    // add the decoded records of a section to the table, and print its log.
+    // sections must be merged in file order.
+    void merge(sectionbuf& buf)
+    {
+        printf("%s", buf.log.c_str());
+
+        uint32_t strbase= _strings.size();
+        _strings += buf.strings;
+        for (auto& row : buf.rows) {
+            _entrytype[row.id]= row.type;
+            _next[row.id]= row.next;
+            _firstchild[row.id]= row.firstchild;
+            _firstvalue[row.id]= row.firstvalue;
+            _nameofs[row.id]= strbase+row.nameofs;
+            _valuetype[row.id]= row.valuetype;
+            _dataofs[row.id]= row.dataofs;
+            _datasize[row.id]= row.datasize;
+            if (row.type==ent::ET_ROOTS) {
+                _roots= buf.roots;
+                _rootsid= row.id;
+            }
+        }
+        if (!buf.error.empty())
+            throw buf.error;
+    }
+
+    virtual bool iskey(uint32_t id) { return id<_entrytype.size() && _entrytype[id]==ent::ET_KEY; }
+    virtual bool isvalue(uint32_t id) { return id<_entrytype.size() && _entrytype[id]==ent::ET_VALUE; }
+    virtual bool hasroots() { return !_roots.empty(); }
+
+    virtual uint32_t rootsid() { return _rootsid; }
+    virtual uint32_t hiveid(int root) { return _roots[root&255]&0x0fffffff; }
+
+    virtual const char *name(uint32_t id) { return &_strings[_nameofs[id]]; }
+    virtual uint32_t nextsibling(uint32_t id) { return _next[id]; }
+    virtual uint32_t firstchild(uint32_t id) { return _firstchild[id]; }
+    virtual uint32_t firstvalue(uint32_t id) { return _firstvalue[id]; }
+
+    virtual uint32_t nextvalue(uint32_t id) { return _next[id]; }
+    uint16_t valuetype(uint32_t id) { return _valuetype[id]; }
+    const uint8_t *valuedata(uint32_t id) { return _image+_dataofs[id]; }
+    size_t valuesize(uint32_t id) { return _datasize[id]; }
+
+    virtual std::string valuestring(uint32_t id)
+    {
+        return ent::valuestring(valuetype(id), valuedata(id), valuesize(id));
+    }
+    virtual void writevalue(outputbuffer& o, uint32_t id)
+    {
+        ent::writevalue(o, valuetype(id), valuedata(id), valuesize(id));
+    }
+};
+
+// on-demand access to the entries of a hive image.
+//
+// only the id -> offset index is built up front, from the section offset
+// blocks. entries are decoded the first time they are requested, and kept
+// in a small direct mapped cache.
+class lazyhive : public hivesource {
+    const uint8_t *_image;
+    uint64_t _imagesize;
+    // id -> entry offset relative to 0x5000, 0 for unused ids.
+    // not owned, usually from buildindex, or a mapped index file
+    const uint32_t *_entryofs;
+    size_t _nentries;
+
+    std::vector<ent::entry_ptr> _cache;
+    StringList _names;          // decoded names of the cached entries
+
+    size_t slot(uint32_t id) { return id&(_cache.size()-1); }
+public:
+    // cachesize must be a power of 2
+    lazyhive(const uint8_t *image, uint64_t imagesize, const uint32_t *entryofs, size_t nentries, size_t cachesize)
+        : _image(image), _imagesize(imagesize), _entryofs(entryofs), _nentries(nentries)
+    {
+        _cache.resize(cachesize);
+        _names.resize(cachesize);
+    }
+    ent::entry_ptr get(uint32_t id)
+    {
+        if (id>=_nentries || _entryofs[id]==0)
+            return ent::entry_ptr();
+        size_t i= slot(id);
+        if (_cache[i] && _cache[i]->id()==id)
+            return _cache[i];
+
+        STATS_STEP(DECODE);
+        uint32_t ofs= _entryofs[id];
+        if (_imagesize<0x5000 || ofs>=_imagesize-0x5000) {
+            printf("WARN: entry %08x: offset %08x past the end of the image\n", id, ofs);
+            return ent::entry_ptr();
+        }
+        ent::entry_ptr e= ent::base::readentry(_image+0x5000+ofs, _imagesize-0x5000-ofs, ofs, 0x10);
+        if (e && e->id()!=id) {
+            printf("WARN: @%08x: entry has id %08x, expected %08x\n", ofs, e->id(), id);
+            return ent::entry_ptr();
+        }
+        _cache[i]= e;
+        if (e && e->askey())
+            _names[i]= e->askey()->name();
+        else if (e && e->asvalue())
+            _names[i]= e->asvalue()->name();
+        return e;
+    }
+    ent::key *getkey(uint32_t id)
+    {
+        auto p= get(id);
+        return p ? p->askey() : NULL;
+    }
+    ent::value *getval(uint32_t id)
+    {
+        auto p= get(id);
+        return p ? p->asvalue() : NULL;
+    }
+
+    virtual bool iskey(uint32_t id) { return getkey(id)!=NULL; }
+    virtual bool isvalue(uint32_t id) { return getval(id)!=NULL; }
+    virtual bool hasroots() { auto p= get(0); return p && p->asroots(); }
+
+    // ids which are missing, or of the wrong type, give 0 or an empty result,
+    // the lookup has already printed a warning for a corrupt entry
+    virtual uint32_t rootsid() { return 0; }
+    virtual uint32_t hiveid(int root)
+    {
+        auto p= get(0);
+        return p && p->asroots() ? p->asroots()->hiveid((HKEY)root) : 0;
+    }
+
+    virtual const char *name(uint32_t id) { return get(id) ? _names[slot(id)].c_str() : ""; }
+    virtual uint32_t nextsibling(uint32_t id) { auto k= getkey(id); return k ? k->nextsibling() : 0; }
+    virtual uint32_t firstchild(uint32_t id) { auto k= getkey(id); return k ? k->firstchild() : 0; }
+    virtual uint32_t firstvalue(uint32_t id) { auto k= getkey(id); return k ? k->firstvalue() : 0; }
+
+    virtual uint32_t nextvalue(uint32_t id) { auto v= getval(id); return v ? v->nextvalue() : 0; }
+    virtual std::string valuestring(uint32_t id) { auto v= getval(id); return v ? v->asstring() : std::string(); }
+    virtual void writevalue(outputbuffer& o, uint32_t id)
+    {
+        if (auto v= getval(id))
+            v->writeto(o);
+    }
+};
+
+class HvFile {
+    ReadWriter_ptr _r;
+
+    // the hive image, decoded entries point into this
+    const uint8_t *_image;
+    uint64_t _imagesize;
+    ByteVector _imagedata;  // only used when not reading from a mapped file
+
+    DwordVector _offsets;
+    ByteVector _bootmd5;
+
+    struct unkitem {
+        uint32_t type;
+        uint32_t ptr;
+        uint32_t unk;
+        uint32_t flag;
+
+
+        unkitem(uint32_t type, uint32_t ptr, uint32_t unk, uint32_t flag)
+            : type(type), ptr(ptr), unk(unk), flag(flag)
+        {
+        }
+    };
+    template<typename V>
+    static bool is_all_zero(const V& v)
+    {
+        typedef typename V::value_type VALTYPE;
+        return v.end()==std::find_if(v.begin(), v.end(), [](const VALTYPE& x) { return x!=VALTYPE(); });
+    }
+    std::vector<unkitem> _unkitems;
+    void readheader()
+    {
+        STATS_PHASE(HEADER);
+        _r->setpos(0);
+        uint32_t hdrsize= _r->read32le();       // +0000
+        uint32_t nul_0004= _r->read32le();      // +0004
+        
+        uint32_t magic= _r->read32le();         // +0008
+        if (magic!=0x4d494b45)                  // 'ELIM'
+            throw "not a hv/vol file";
+
+        ByteVector filemd5;
+        vectorread8(_r, filemd5, 16);           // +000c
+
+        uint32_t nul_001c= _r->read32le();      // +001c
+        uint32_t filesize= _r->read32le();      // +0020
+        if (filesize>_r->size()) {
+            printf("WARN: stored filesize > real filesize\n");
+        }
+        if (filesize<_r->size()) {
+            printf("WARN: stored filesize < real filesize\n");
+        }
+        uint32_t filetype= _r->read32le();      // +0024  - 0x1000 for db files
+
+        vectorread8(_r, _bootmd5, 16);           // +0028
+
+        DwordVector usuallynul_0038;
+        vectorread32le(_r, usuallynul_0038, (0xE4-0x38)/4);     // +0038
+        if (!is_all_zero(usuallynul_0038))
+            printf("WARN: +0038: %s\n", vhexdump(usuallynul_0038).c_str());
+
+        uint32_t base= _r->read32le();           // +00e4  .. 0x01025000
+        uint32_t nul_00e8= _r->read32le();      // +00e8  recoverylog size
+        uint32_t isreghive= _r->read32le();     // +00ec
+        uint32_t isdbvol= _r->read32le();       // +00f0
+
+        if (isreghive && filetype!=0)
+            printf("WARNING, unknown flag combination: +0024=%08x, +00ec=%08x\n", filetype, isreghive);
+        if (isdbvol && filetype==0)
+            printf("WARNING, unknown flag combination: +0024=%08x, +00ec=%08x\n", filetype, isdbvol);
+
+        if (hdrsize!=0x400)
+            printf("WARN: unusual hdrsize : %08x\n", hdrsize);
+        if (nul_0004)
+            printf("WARN: +0004: %08x\n", nul_0004);
+        if (nul_001c)
+            printf("WARN: +001c: %08x\n", nul_001c);
+        if (nul_00e8)
+            printf("WARN: +00e8: %08x\n", nul_00e8);
+
+        if (g_verbose) {
+            _r->setpos(0);
+            DwordVector filehdr1;
+            vectorread32le(_r, filehdr1, 0x38/4);
+            DwordVector filehdr2;
+            _r->setpos(0xe4);
+            vectorread32le(_r, filehdr2, (0xf4-0xe4)/4);
+            printf("          hdrsize           magic    --filemd5--------------------------          filesize filetype --bootmd5-------------------------- ... base              isreghv  isdbvol\n");
+            printf("filehdr: %s ...%s\n", vhexdump(filehdr1).c_str(), vhexdump(filehdr2).c_str());
+        }
+
+
+        DwordVector usuallynul_00f4;
+        vectorread32le(_r, usuallynul_00f4, 6); // +00f4
+        if (!is_all_zero(usuallynul_00f4))
+            printf("WARN: +00f4: %s\n", vhexdump(usuallynul_00f4).c_str());
+
+        if (g_verbose) {
+            // read unknown items --- probably ptrs used when mounted
+            printf("base=%08x\n", base);
+            uint32_t ofs= 0x10c;
+            while (ofs<hdrsize) {
+                uint32_t type= _r->read32le();      // +010c + 0x10*i
+                uint32_t ptr= _r->read32le();       // +0110 + 0x10*i
+                uint32_t unk= _r->read32le();       // +0114 + 0x10*i
+                uint32_t flag= _r->read32le();      // +0118 + 0x10*i
+                if (type==0)
+                    break;
+
+                _unkitems.push_back(unkitem(type, ptr, unk, flag));
+
+                printf("%d %08x[+%8x]  %08x %8x\n", type, ptr, ptr-base, unk, flag);
+            }
+        }
+
+
+        // read section ptrs
+        _r->setpos(0x1000);
+
+        _offsets.push_back(_r->read32le());     // +1000
+        while (1)
+        {
+            uint32_t sofs= _r->read32le();      // +1000 + 4*i
+            if (sofs==0)
+                break;
+            _offsets.push_back(sofs);
+        }
+        if (g_verbose)
+            printf("hdrptrs: %s\n", vhexdump(_offsets).c_str());
+        _offsets.push_back(filesize);
+
+        // read section headers
+        for (unsigned i=0 ; i<_offsets.size()-1 ; i++)
+        {
+            _r->setpos(0x5000+_offsets[i]);
+
+            uint32_t smagic= _r->read32le();    // +5000
+            uint32_t snul_0004= _r->read32le(); // +5004
+            uint32_t idx= _r->read32le();       // +5008
+            if (smagic!=0x20001004)
+                throw "invalid section magic";
+            if (snul_0004)
+                printf("WARN: section%d @%08x : +4=%08x\n", i, _offsets[i], snul_0004);
+            if (idx!=i)
+                printf("WARN: section%d @%08x : +8=%08x\n", i, _offsets[i], idx);
+        }
+    }
+    // build the 0x5000 byte file header and section table in memory,
+    // the filemd5 is filled in by the caller.
+    void encodeheader(ByteVector& hdr, uint32_t filesize, const std::vector<uint32_t>& sectionoffsets)
+    {
+        hdr.clear();
+        BV_AppendDword(hdr, 0x400);                     // +0000 : filehdr size
+        BV_AppendDword(hdr, 0);                         // +0004 : 
+        BV_AppendDword(hdr, 0x4d494b45);                // +0008 : file magic 'MIKE'
+        hdr.resize(0x20);                               // +000c : filemd5 later
+        BV_AppendDword(hdr, filesize);                  // +0020 : filesize
+        BV_AppendDword(hdr, 0);                         // +0024 : filetype : 0 = hv
+        hdr.insert(hdr.end(), _bootmd5.begin(), _bootmd5.end()); // +0028 : bootmd5
+
+        hdr.resize(0xe4);
+        BV_AppendDword(hdr, 0x01025000);                // +00e4 : base ??
+        hdr.resize(0xec);
+        BV_AppendDword(hdr, -1);                        // +00ec : isreghive
+
+        hdr.resize(0x1000);
+        for (auto ofs : sectionoffsets)
+            BV_AppendDword(hdr, ofs);                   // +1000 : section offsets
+        hdr.resize(0x5000);
+    }
+    // the size of the section header, item offset block and item count
+    enum { SECTIONHDRSIZE= 12 + 0x1000 + 4 };
+
+    // encode the items of section n, [n*0x400, n*0x400+0x400), into sect,
+    // after space for the section header. itemoffsets receives the offsets of
+    // the items relative to the start of the section.
+    // this only reads the items, so sections can be encoded concurrently.
+    void encodesection(ByteVector& sect, DwordVector& itemoffsets, unsigned n)
+    {
+        STATS_PHASE_DETAIL(SAVE, stringformat("section %d", n));
+        unsigned i= n*0x400;
+        unsigned count= std::min(_items.size()-i, size_t(0x400));
+
+        sect.clear();
+        sect.resize(SECTIONHDRSIZE);
+        itemoffsets.clear();
+        for (unsigned j= 0 ; j<count ; j++)
+        {
+            itemoffsets.push_back(sect.size());
+            _items[i+j]->save(sect);
+        }
+    }
+    // fill in the header of section n, now that its offset relative
+    // to 0x5000, sectofs, is known.
+    void finishsection(ByteVector& sect, const DwordVector& itemoffsets, unsigned n, uint32_t sectofs)
+    {
+        unsigned count= itemoffsets.size();
+
+        ByteVector hdr;
+        hdr.reserve(SECTIONHDRSIZE);
+        BV_AppendDword(hdr, 0x20001004);
+        BV_AppendDword(hdr, 0);
+        BV_AppendDword(hdr, n);
+        for (unsigned j= 0 ; j<0x400 ; j++)
+            BV_AppendDword(hdr, j<count ? sectofs+itemoffsets[j]+1 : j<0x3ff ? (j+1)*0x40000 : 0);
+        BV_AppendDword(hdr, count<0x400 ? count : 0);
+
+        std::copy(hdr.begin(), hdr.end(), sect.begin());
+    }
+    // encode all sections, using nthreads worker threads
+    void encodesections(std::vector<ByteVector>& sections, std::vector<DwordVector>& offsets, unsigned nthreads)
+    {
+        unsigned nsections= sections.size();
+        if (nthreads<=1 || nsections<=1) {
+            for (unsigned n=0 ; n<nsections ; n++)
+                encodesection(sections[n], offsets[n], n);
+            return;
+        }
+
+        std::atomic<unsigned> next(0);
+        std::exception_ptr error;
+        std::mutex mtx;
+
+        std::vector<std::thread> workers;
+        for (unsigned t=0 ; t<nthreads && t<nsections ; t++)
+            workers.push_back(std::thread([&]() {
+                while (true) {
+                    unsigned n= next++;
+                    if (n>=nsections)
+                        break;
+                    try {
+                        encodesection(sections[n], offsets[n], n);
+                    }
+                    catch(...) {
+                        std::lock_guard<std::mutex> lock(mtx);
+                        if (!error)
+                            error= std::current_exception();
+                        next= nsections;
+                    }
+                }
+            }));
+        for (auto& w : workers)
+            w.join();
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+public:
+    // the section table at +1000 ends with a 0 before +5000, and entry
+    // offsets are stored in 28 bits
+    enum { MAXSECTIONS= 0xfff, MAXOFFSET= 0x0ffffffc };
+
+    HvFile()
+        : _image(NULL), _imagesize(0), _rootid(0)
+    {
+        _items.push_back(ent::entry_ptr(new ent::roots(_items.size())));
+        _rootid= _items.back()->id();
+    }
+    // decode a hive from memory, usually a mappedfile.
+    HvFile(const uint8_t *image, uint64_t size)
+        : _r(new MemoryReader(image, size)), _image(image), _imagesize(size), _rootid(0)
+    {
+        readheader();
+    }
+    // decode a hive from a reader, the file is first loaded into memory.
+    HvFile(ReadWriter_ptr r)
+        : _r(r), _rootid(0)
+    {
+        r->setpos(0);
+        vectorread8(r, _imagedata, r->size());
+        _image= _imagedata.data();
+        _imagesize= _imagedata.size();
+
+        readheader();
+    }
+    void setbootmd5(const ByteVector& md5)
+    {
+        _bootmd5= md5;
+    }
+    // write the hive front to back, with one write per section.
+    // the filemd5 covers the section table in the header, so all sections are
+    // encoded first, and hashed from memory, the output is never read back.
+    // sections only depend on their own items, and are encoded using nthreads
+    // worker threads, the output does not depend on the nr of threads.
+    void save(ReadWriter_ptr w, unsigned nthreads= 1)
+    {
+        STATS_PHASE(SAVE);
+        unsigned nsections= (_items.size()+0x3ff)/0x400;
+        // the section table ends with a 0 before +5000
+        if (nsections>MAXSECTIONS)
+            throw stringformat("too many entries for a hive: %d", int(_items.size()));
+
+        std::vector<ByteVector> sections(nsections);
+        std::vector<DwordVector> itemoffsets(nsections);
+        encodesections(sections, itemoffsets, nthreads);
+
+        std::vector<uint32_t> sectionoffsets;
+        uint32_t sectofs= 0;
+        for (unsigned n=0 ; n<nsections ; n++)
+        {
+            ByteVector& sect= sections[n];
+            sectionoffsets.push_back(sectofs);
+            finishsection(sect, itemoffsets[n], n, sectofs);
+
+            // the file ends on a page boundary
+            uint32_t endofs= sectofs+sect.size();
+            if (n==nsections-1 && (endofs&0xfff))
+                sect.resize(sect.size()+0x1000-(endofs&0xfff));
+
+            // item offsets are stored in 28 bits
+            if (sect.size()>MAXOFFSET-sectofs)
+                throw "hive too large";
+            sectofs += sect.size();
+        }
+
+        ByteVector hdr;
+        encodeheader(hdr, 0x5000+sectofs, sectionoffsets);
+
+        // +000c : filemd5, over everything from +00fc to the end of the file
+        {
+            STATS_PHASE(MD5);
+            STATS_BYTES(MD5, hdr.size()-0xfc+sectofs);
+            Md5 m;
+            m.add(&hdr[0xfc], hdr.size()-0xfc);
+            for (auto& sect : sections)
+                m.add(sect.data(), sect.size());
+            m.final(&hdr[0x0c]);
+        }
+        STATS_BYTES(SAVE, hdr.size()+sectofs);
+
+        w->setpos(0);
+        w->write(hdr.data(), hdr.size());
+        for (auto& sect : sections) {
+            w->write(sect.data(), sect.size());
+            ByteVector().swap(sect);
+        }
+    }
+    // the nr of entry id slots in this hive
+    uint32_t maxentries()
+    {
+        return (_offsets.size()-1)*0x400;
+    }
+    // decode all sections into tab, using nthreads worker threads.
+    // sections are merged in file order, so the output is the same as
+    // when decoding on a single thread.
+    void loadtable(hivetable& tab, unsigned nthreads)
+    {
+        unsigned nsections= _offsets.size()-1;
+        if (nthreads<=1 || nsections<=1) {
+            for (unsigned i=0 ; i<nsections ; i++) {
+                hivetable::sectionbuf buf;
+                decodesection(tab, i, buf);
+                tab.merge(buf);
+            }
+            return;
+        }
+
+        std::vector<hivetable::sectionbuf> bufs(nsections);
+        // other exceptions than the decode errors, like bad_alloc, rethrown by the merge loop
+        std::vector<std::exception_ptr> errors(nsections);
+        std::vector<char> ready(nsections);
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::atomic<unsigned> next(0);
+
+        std::vector<std::thread> workers;
+        for (unsigned t=0 ; t<nthreads && t<nsections ; t++)
+            workers.push_back(std::thread([&]() {
+                while (true) {
+                    unsigned i= next++;
+                    if (i>=nsections)
+                        break;
+                    try {
+                        decodesection(tab, i, bufs[i]);
+                    }
+                    catch(...) {
+                        errors[i]= std::current_exception();
+                    }
+
+                    std::lock_guard<std::mutex> lock(mtx);
+                    ready[i]= 1;
+                    cv.notify_all();
+                }
+            }));
+
+        try {
+            for (unsigned i=0 ; i<nsections ; i++) {
+                {
+                    std::unique_lock<std::mutex> lock(mtx);
+                    cv.wait(lock, [&]() { return ready[i]!=0; });
+                }
+                if (errors[i])
+                    std::rethrow_exception(errors[i]);
+                tab.merge(bufs[i]);
+                bufs[i]= hivetable::sectionbuf();
+            }
+        }
+        catch(...) {
+            next= nsections;
+            for (auto& w : workers)
+                w.join();
+            throw;
+        }
+        for (auto& w : workers)
+            w.join();
+    }
+    void decodesection(const hivetable& tab, unsigned i, hivetable::sectionbuf& buf)
+    {
+        STATS_PHASE_DETAIL(DECODE, stringformat("section %d", i));
+        try {
+            std::vector<recordref> recs;
+            readsectionindex(_offsets[i], _imagesize-0x5000, recs, buf.log);
+            for (auto& rec : recs)
+                tab.decoderecord(buf, _image+0x5000+rec.ofs, _imagesize-0x5000-rec.ofs, rec.ofs, rec.flag);
+        }
+        catch(const char*msg) { buf.error= msg; }
+        catch(const std::string& msg) { buf.error= msg; }
+    }
+    void enumfileentries(std::function<void(ent::entry_ptr)> cb)
+    {
+        enumfilerecords([&cb](const uint8_t *p, size_t maxsize, uint32_t ofs, uint8_t flag) {
+            cb(ent::base::readentry(p, maxsize, ofs, flag));
+        });
+    }
+
+    // build the id -> entry offset index for a lazyhive.
+    // only the section offset blocks are read, entry ids are
+    // section*0x400 + slot, as allocated by save.
+    void buildindex(DwordVector& entryofs)
+    {
+        STATS_PHASE(SECTIONS);
+        entryofs.clear();
+        entryofs.resize(maxentries());
+        uint32_t maxofs= _r->size()-0x5000;
+        for (unsigned i=0 ; i<_offsets.size()-1 ; i++)
+        {
+            DwordVector iofs;
+            _r->setpos(0x5000 + _offsets[i] + 12);
+            vectorread32le(_r, iofs, 0x400);
+            for (unsigned j=0 ; j<iofs.size() ; j++)
+            {
+                uint32_t ofs= iofs[j]&0x0ffffffc;
+                if ((iofs[j]&3)==1 && ofs<maxofs)
+                    entryofs[i*0x400+j]= ofs;
+            }
+        }
+    }
+
+    // records are passed as ptr to the image, nr of bytes available, file offset, flag
+    typedef std::function<void(const uint8_t*,size_t,uint32_t,uint8_t)> recordfn_t;
+    void enumfilerecords(recordfn_t cb)
+    {
+        for (unsigned i=0 ; i<_offsets.size()-1 ; i++)
+            enumsectionentries(_offsets[i], _r->size()-0x5000, cb);
+    }
+    void enumsectionentries(uint32_t startofs, uint32_t maxofs, recordfn_t cb)
+    {
+        std::vector<recordref> recs;
+        std::string log;
+        readsectionindex(startofs, maxofs, recs, log);
+        printf("%s", log.c_str());
+
+        for (auto& rec : recs)
+            cb(_image + 0x5000 + rec.ofs, _imagesize-0x5000-rec.ofs, rec.ofs, rec.flag);
+    }
+
+    struct recordref {
+        uint32_t ofs;
+        uint8_t flag;
+    };
+    // read the section header and offset block at startofs.
+    // verbose output and warnings are appended to log.
+    // this reads directly from the image, not through _r, so it can be
+    // called from multiple threads.
+    void readsectionindex(uint32_t startofs, uint32_t maxofs, std::vector<recordref>& recs, std::string& log)
+    {
+        STATS_PHASE(SECTIONS);
+        MemoryReader r(_image, _imagesize);
+        uint32_t ofs= startofs;
+        if (g_verbose>1)
+            log += stringformat("%08x-%08x: sectionhdr\n", ofs, ofs+12);
+        DwordVector hdrvalues;
+        r.setpos(0x5000 + ofs);
+        vectorread32le(&r, hdrvalues, 3);
+        ofs += 12;
+
+        if (g_verbose>1)
+            log += stringformat("%08x-%08x: entryptrs\n", ofs, ofs+0x1000);
+        DwordVector iofs;
+        r.setpos(0x5000 + ofs);
+        vectorread32le(&r, iofs, 0x400);
+        ofs += 0x1000;
+
+        if (g_verbose>1)
+            log += stringformat("%08x-%08x: entrycount\n", ofs, ofs+4);
+        // todo:  is this really a count, or something else? it points to the entry with value 0x10000000
+        uint32_t count= r.read32le();
+        if (g_verbose) {
+            log += stringformat("hdr: %s [%08x] %s\n", vhexdump(hdrvalues).c_str(), count, vhexdump(iofs).c_str());
+        }
+
+        ofs += 4;
+
+        for (unsigned i=0 ; i<1024; i++)
+        {
+            uint32_t entryofs= iofs[i]&0x0ffffffc;
+            if ((iofs[i]&3)==1 && entryofs<maxofs) {
+                recordref rec= { entryofs, uint8_t((iofs[i]>>28)|((iofs[i]&3)<<4)) };
+                recs.push_back(rec);
+            }
+            else if (iofs[i]!=(i+1)*0x40000 && iofs[i]!=0) {
+                log += stringformat("WARN: @%08x: entry %03x: %08x\n", startofs+12+i*4, i, iofs[i]);
+            }
+        }
+    }
+
+
+    uint32_t _rootid;
+    std::vector<ent::entry_ptr> _items;
+
+    // the keys created so far: (parent, case folded name hash) -> key id.
+    // the parent of the top level keys of a hive is the hive root.
+    std::unordered_multimap<uint64_t,uint32_t> _keys;
+
+    static uint64_t keyhash(HKEY root, uint32_t parent, std::string_view name)
+    {
+        uint64_t parentkey= parent ? parent : uint64_t(root)<<32;
+        return foldednamehash(name) ^ (parentkey * 0x9e3779b97f4a7c15ULL);
+    }
+
+    uint32_t allocpath(HKEY root, uint32_t parent, const std::string& path)
+    {
+        _items.push_back(ent::entry_ptr(new ent::key(_items.size(), path)));
+        uint32_t id= _items.back()->id();
+
+        if (parent) {
+            uint32_t lkey= _items[parent]->askey()->lastchild();
+            if (!lkey)
+                _items[parent]->askey()->firstchild(id);
+            else
+                _items[lkey]->askey()->nextsibling(id);
+            _items[parent]->askey()->lastchild(id);
+        }
+        else {
+            uint32_t rkey= _items[_rootid]->asroots()->lasthivekey(root);
+            if (!rkey)
+                _items[_rootid]->asroots()->hiveid(root, id);
+            else 
+                _items[rkey]->askey()->nextsibling(id);
+            _items[_rootid]->asroots()->lasthivekey(root, id);
+        }
+
+        return id;
+    }
+    // returns the id of the key at path, creating the keys which don't exist yet.
+    // each path component costs one hash lookup, only new keys allocate.
+    uint32_t CreateKey(const RegistryPath& regpath)
+    {
+        HKEY root= regpath.GetRoot();
+        std::string path= regpath.GetPath();
+
+        uint32_t parent= 0;
+        size_t start= 0;
+        while (true)
+        {
+            size_t end= path.find('\\', start);
+            if (end==path.npos)
+                end= path.size();
+            std::string_view name(path.data()+start, end-start);
+
+            uint64_t h= keyhash(root, parent, name);
+            uint32_t id= 0;
+            auto range= _keys.equal_range(h);
+            for (auto i= range.first ; i!=range.second && !id ; ++i)
+                if (_items[i->second]->askey()->nameequal(name))
+                    id= i->second;
+            if (!id) {
+                id= allocpath(root, parent, std::string(name));
+                _keys.insert(std::make_pair(h, id));
+            }
+
+            if (end==path.size())
+                return id;
+            parent= id;
+            start= end+1;
+        }
+    }
+    // create a value entry with the given id
+    static ent::value_ptr makevalue(uint32_t id, const std::string& valuename, const RegistryValue& value)
+    {
+        ent::value_ptr v;
+        switch(value.GetType())
+        {
+            case REG_SZ:       v= ent::value_ptr(new ent::stringvalue(id, valuename, value.GetString())); break;
+            case REG_BINARY:   v= ent::value_ptr(new ent::binaryvalue(id, valuename, value.GetData())); break;
+            case REG_DWORD:    v= ent::value_ptr(new ent::dwordvalue(id, valuename, value.GetDword())); break;
+            case REG_MULTI_SZ: v= ent::value_ptr(new ent::stringlistvalue(id, valuename, value.GetStringList())); break;
+            case REG_MUI_SZ:   v= ent::value_ptr(new ent::muistringvalue(id, valuename, value.GetString())); break;
+        }
+        if (!v) {
+            printf("WARN: unsupported: %s\n", value.AsString(0).c_str());
+            throw "unsupported registryvalue type";
+        }
+        return v;
+    }
+    void SetValue(uint32_t keyid, const std::string& valuename, const RegistryValue& value)
+    {
+        ent::value_ptr v= makevalue(_items.size(), valuename, value);
+
+        _items.push_back(v);
+
+        uint32_t lastv= _items[keyid]->askey()->lastvalue();
+        if (lastv==0)
+            _items[keyid]->askey()->firstvalue(v->id());
+        else
+            _items[lastv]->asvalue()->nextvalue(v->id());
+        _items[keyid]->askey()->lastvalue(v->id());
+
+    }
+};
+struct hvmaker : regkeymaker {
+    HvFile hv;
+    uint32_t curkey;
+    hvmaker()
+        : curkey(0)
+    {
+    }
+    void newkey(const RegistryPath& path)
+    {
+        STATS_STEP(MAKE);
+        curkey= hv.CreateKey(path);
+    }
+    void setval(const std::string& valuename, const RegistryValue& value)
+    {
+        STATS_STEP(MAKE);
+        hv.SetValue(curkey, valuename=="@" ? "Default" : valuename, value);
+    }
+
+    void setbootmd5(const ByteVector& md5)
+    {
+        hv.setbootmd5(md5);
+    }
+    void save(ReadWriter_ptr w, unsigned nthreads)
+    {
+        hv.save(w, nthreads);
+    }
+};
+#endif
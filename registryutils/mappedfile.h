@@ -0,0 +1,119 @@
+#ifndef _MAPPED_FILE_H_
+#define _MAPPED_FILE_H_
+#include <string>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include "stringutils.h"
+#include "phasestats.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// mapping of an entire file, read-only unless opened writable.
+// data taken from the mapping, like entries decoded from a mapped hive,
+// points directly into this memory, so the mapping must outlive it.
+class mappedfile {
+#ifdef _WIN32
+    HANDLE _hf;
+    HANDLE _hmap;
+#else
+    int _fd;
+#endif
+    const uint8_t *_p;
+    uint64_t _size;
+    bool _writable;
+public:
+    // with writable set, changes made through writabledata go to the file
+    mappedfile(const std::string& filename, bool writable= false)
+        : _p(NULL), _size(0), _writable(writable)
+    {
+        STATS_PHASE_DETAIL(OPEN, filename);
+#ifdef _WIN32
+        _hmap= NULL;
+        _hf= CreateFileA(filename.c_str(), writable ? GENERIC_READ|GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+        if (_hf==INVALID_HANDLE_VALUE)
+            throw stringformat("%s: open failed", filename.c_str());
+        LARGE_INTEGER li;
+        GetFileSizeEx(_hf, &li);
+        _size= li.QuadPart;
+        if (_size) {
+            _hmap= CreateFileMapping(_hf, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL);
+            if (_hmap)
+                _p= (const uint8_t*)MapViewOfFile(_hmap, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+            if (_p==NULL) {
+                close();
+                throw stringformat("%s: mmap failed", filename.c_str());
+            }
+        }
+#else
+        _fd= open(filename.c_str(), writable ? O_RDWR : O_RDONLY);
+        if (_fd==-1)
+            throw stringformat("%s: %s", filename.c_str(), strerror(errno));
+        struct stat st;
+        if (fstat(_fd, &st)==-1) {
+            close();
+            throw stringformat("%s: %s", filename.c_str(), strerror(errno));
+        }
+        _size= st.st_size;
+        if (_size) {
+            void *p= mmap(NULL, _size, writable ? PROT_READ|PROT_WRITE : PROT_READ, MAP_SHARED, _fd, 0);
+            if (p==MAP_FAILED) {
+                close();
+                throw stringformat("%s: mmap: %s", filename.c_str(), strerror(errno));
+            }
+            _p= (const uint8_t*)p;
+        }
+#endif
+        STATS_BYTES(OPEN, _size);
+    }
+    ~mappedfile()
+    {
+        close();
+    }
+    void close()
+    {
+#ifdef _WIN32
+        if (_p) UnmapViewOfFile(_p);
+        if (_hmap) CloseHandle(_hmap);
+        if (_hf!=INVALID_HANDLE_VALUE) CloseHandle(_hf);
+        _hmap= NULL;
+        _hf= INVALID_HANDLE_VALUE;
+#else
+        if (_p) munmap((void*)_p, _size);
+        if (_fd!=-1) ::close(_fd);
+        _fd= -1;
+#endif
+        _p= NULL;
+    }
+    const uint8_t *data() const { return _p; }
+    uint64_t size() const { return _size; }
+
+    uint8_t *writabledata()
+    {
+        if (!_writable)
+            throw std::string("mappedfile: not writable");
+        return (uint8_t*)_p;
+    }
+    // write changes back to the file
+    void flush()
+    {
+        if (!_p || !_writable)
+            return;
+#ifdef _WIN32
+        if (!FlushViewOfFile(_p, 0))
+            throw std::string("mappedfile: flush failed");
+#else
+        if (msync((void*)_p, _size, MS_SYNC)==-1)
+            throw stringformat("mappedfile: msync: %s", strerror(errno));
+#endif
+    }
+};
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef _PHASE_STATS_H_
+#define _PHASE_STATS_H_
+// wall and cpu time, call and byte counts per processing phase, printed by
+// hvtool --stats, and a timeline of the phases of each thread, written by
+// hvtool --trace. without WITH_STATS, the STATS_ macros compile to nothing.
+//
+// STATS_PHASE(p)   times the rest of the scope, wall and cpu time
+// STATS_PHASE_DETAIL(p, detail)  the same, the detail string is shown in the trace
+// STATS_STEP(p)    the same, but only wall time, for scopes entered per entry
+// STATS_BYTES(p,n) adds n to the byte count of phase p
+// STATS_ENTRY(t)   counts a decoded entry of type t
+//
+// times are exclusive: a nested scope pauses the enclosing scope on the same
+// thread. the cpu time of a STEP is counted in the enclosing PHASE. worker
+// threads each add their own time, so a phase can take more wall time than
+// the whole run. the trace has one span per PHASE scope, STEPs are not traced.
+#ifdef WITH_STATS
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+struct phasestats {
+    enum phase {
+        OPEN,       // open and map the file
+        HEADER,     // readheader
+        SECTIONS,   // section enumeration
+        DECODE,     // entry decoding
+        TRAVERSE,   // key tree traversal
+        OUTPUT,     // formatting and writing output
+        PARSE,      // .reg file parsing
+        VALUESPEC,  // RegistryValue::FromValueSpec
+        MAKE,       // CreateKey and SetValue
+        SAVE,       // encoding and writing the hive
+        MD5,        // hashing the hive
+        NPHASES
+    };
+    static const char *name(int p)
+    {
+        static const char *names[NPHASES]= { "open", "readheader", "sections", "decode", "traverse", "output",
+            "parse", "valuespec", "make", "save", "md5" };
+        return names[p];
+    }
+    struct counters {
+        std::atomic<uint64_t> wallns;
+        std::atomic<uint64_t> cpuns;
+        std::atomic<uint64_t> calls;
+        std::atomic<uint64_t> bytes;
+    };
+    static inline bool enabled= false;
+    static inline counters phases[NPHASES];
+    static inline std::atomic<uint64_t> entries[16];     // decoded entries per type
+
+    static uint64_t wallclock()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    // cpu time of the current thread
+    static uint64_t cpuclock()
+    {
+#ifdef _WIN32
+        FILETIME c, e, k, u;
+        GetThreadTimes(GetCurrentThread(), &c, &e, &k, &u);
+        return ((uint64_t(k.dwHighDateTime)<<32 | k.dwLowDateTime) + (uint64_t(u.dwHighDateTime)<<32 | u.dwLowDateTime))*100;
+#else
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return uint64_t(ts.tv_sec)*1000000000+ts.tv_nsec;
+#endif
+    }
+
+    // --trace: the PHASE scopes of each thread, as chrome trace events
+    struct traceevent {
+        int phase;
+        uint64_t start;     // ns since traceorigin
+        uint64_t end;
+        std::string detail;
+    };
+    struct tracebuffer {
+        int tid;
+        std::vector<traceevent> events;
+    };
+    static inline bool tracing= false;
+    static inline uint64_t traceorigin;
+    static inline std::mutex tracemtx;
+    static inline std::vector<std::unique_ptr<tracebuffer>> tracebuffers;
+
+    static void starttrace()
+    {
+        traceorigin= wallclock();
+        tracing= true;
+    }
+    // the buffers outlive their threads, and are written when main exits
+    static tracebuffer& threadtrace()
+    {
+        static thread_local tracebuffer *buf= nullptr;
+        if (!buf) {
+            std::lock_guard<std::mutex> lock(tracemtx);
+            tracebuffers.emplace_back(new tracebuffer);
+            buf= tracebuffers.back().get();
+            buf->tid= tracebuffers.size();
+        }
+        return *buf;
+    }
+
+    class scope {
+        scope *_parent;
+        int _phase;
+        bool _cpu;
+        bool _counted;
+        uint64_t _wallstart;
+        uint64_t _cpustart;
+        uint64_t _tracestart;
+        std::string _detail;
+
+        static scope*& current()
+        {
+            static thread_local scope *cur= nullptr;
+            return cur;
+        }
+        // add the time since the last start to the phase, cpu time is only
+        // passed by scopes which measure it
+        void stop(uint64_t wall, uint64_t cpu, bool withcpu)
+        {
+            phases[_phase].wallns += wall-_wallstart;
+            if (_cpu && withcpu)
+                phases[_phase].cpuns += cpu-_cpustart;
+        }
+    public:
+        scope(int phase, bool cpu, std::string_view detail= std::string_view())
+            : _parent(nullptr), _phase(phase), _cpu(cpu), _counted(false), _wallstart(0), _cpustart(0), _tracestart(0)
+        {
+            // only PHASE scopes are traced, STEPs are too frequent
+            if (tracing && _cpu) {
+                _tracestart= wallclock();
+                _detail= detail;
+            }
+            if (!enabled)
+                return;
+            _counted= true;
+            phases[_phase].calls++;
+            _wallstart= wallclock();
+            if (_cpu)
+                _cpustart= cpuclock();
+            _parent= current();
+            if (_parent)
+                _parent->stop(_wallstart, _cpustart, _cpu);
+            current()= this;
+        }
+        ~scope()
+        {
+            if (_tracestart) {
+                uint64_t end= wallclock();
+                threadtrace().events.push_back(traceevent{_phase, _tracestart-traceorigin, end-traceorigin, std::move(_detail)});
+            }
+            if (!_counted)
+                return;
+            uint64_t wall= wallclock();
+            uint64_t cpu= _cpu ? cpuclock() : 0;
+            stop(wall, cpu, _cpu);
+            current()= _parent;
+            if (_parent) {
+                _parent->_wallstart= wall;
+                if (_cpu)
+                    _parent->_cpustart= cpu;
+            }
+        }
+    };
+};
+
+#define STATS_CONCAT2(a, b) a##b
+#define STATS_CONCAT(a, b) STATS_CONCAT2(a, b)
+#define STATS_PHASE(p) phasestats::scope STATS_CONCAT(_stats_scope_, __LINE__)(phasestats::p, true)
+#define STATS_PHASE_DETAIL(p, detail) phasestats::scope STATS_CONCAT(_stats_scope_, __LINE__)(phasestats::p, true, phasestats::tracing ? (detail) : std::string())
+#define STATS_STEP(p) phasestats::scope STATS_CONCAT(_stats_scope_, __LINE__)(phasestats::p, false)
+#define STATS_BYTES(p, n) do { if (phasestats::enabled) phasestats::phases[phasestats::p].bytes += (n); } while(0)
+#define STATS_ENTRY(t) do { if (phasestats::enabled) phasestats::entries[(t)&15]++; } while(0)
+#else
+#define STATS_PHASE(p) do { } while(0)
+#define STATS_PHASE_DETAIL(p, detail) do { } while(0)
+#define STATS_STEP(p) do { } while(0)
+#define STATS_BYTES(p, n) do { } while(0)
+#define STATS_ENTRY(t) do { } while(0)
+#endif
+#endif
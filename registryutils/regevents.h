@@ -0,0 +1,148 @@
+#ifndef _REG_EVENTS_H_
+#define _REG_EVENTS_H_
+#include <string>
+#include <string.h>
+#include "vectorutils.h"
+#include "regpath.h"
+#include "regvalue.h"
+#include "regfileparser.h"
+
+// the keys and values of a parsed .reg file, in a compact binary form:
+// the events passed to a regkeymaker, which can be replayed without parsing.
+//
+//   "HVRC", version
+//   'K' root path        newkey
+//   'V' name type data   setval
+//   'D' root path        deletekey
+//   'X' name             deleteval
+//   'E' size             end, with the size of the stream
+//
+// strings and data are stored as a dword length followed by the bytes.
+class regevents : public regkeymaker {
+    ByteVector _data;
+
+    enum { VERSION= 1 };
+
+    void addstring(const std::string& str)
+    {
+        BV_AppendDword(_data, str.size());
+        _data.insert(_data.end(), str.begin(), str.end());
+    }
+    void addpath(const RegistryPath& path)
+    {
+        BV_AppendDword(_data, uint32_t(uintptr_t(path.GetRoot())));
+        addstring(path.GetPath());
+    }
+
+    // reads the event stream, throws on truncated data
+    class reader {
+        const uint8_t *_p;
+        const uint8_t *_end;
+        void need(size_t n)
+        {
+            if (size_t(_end-_p)<n)
+                throw "regevents: truncated";
+        }
+    public:
+        reader(const uint8_t *p, size_t size) : _p(p), _end(p+size) { }
+        bool eof() const { return _p==_end; }
+        uint8_t byte() { need(1); return *_p++; }
+        uint32_t dword() { need(4); uint32_t x= get32le(_p); _p+=4; return x; }
+        std::string string()
+        {
+            uint32_t n= dword();
+            need(n);
+            std::string str((const char*)_p, n);
+            _p += n;
+            return str;
+        }
+        RegistryPath path()
+        {
+            HKEY root= (HKEY)(intptr_t)int32_t(dword());
+            return RegistryPath(RegistryPath(root), string());
+        }
+    };
+public:
+    regevents()
+    {
+        _data= { 'H', 'V', 'R', 'C' };
+        BV_AppendDword(_data, VERSION);
+    }
+    virtual void newkey(const RegistryPath& path)
+    {
+        _data.push_back('K');
+        addpath(path);
+    }
+    virtual void setval(const std::string& name, const RegistryValue& value)
+    {
+        _data.push_back('V');
+        addstring(name);
+        BV_AppendDword(_data, value.GetType());
+        ByteVector data= value.GetData();
+        BV_AppendDword(_data, data.size());
+        _data.insert(_data.end(), data.begin(), data.end());
+    }
+    virtual void deletekey(const RegistryPath& path)
+    {
+        _data.push_back('D');
+        addpath(path);
+    }
+    virtual void deleteval(const std::string& name)
+    {
+        _data.push_back('X');
+        addstring(name);
+    }
+    // add the end marker, after which data can be replayed
+    void close()
+    {
+        _data.push_back('E');
+        BV_AppendDword(_data, _data.size()+4);
+    }
+    const ByteVector& data() const { return _data; }
+
+    // true when data is a complete and valid event stream, replay can then
+    // not fail halfway, after passing part of the events to a maker
+    static bool check(const uint8_t *p, size_t size)
+    {
+        struct nullmaker : regkeymaker {
+            virtual void newkey(const RegistryPath&) { }
+            virtual void setval(const std::string&, const RegistryValue&) { }
+            virtual void deletekey(const RegistryPath&) { }
+            virtual void deleteval(const std::string&) { }
+        };
+        nullmaker mk;
+        try {
+            return replay(p, size, mk);
+        }
+        catch(...) {
+            return false;
+        }
+    }
+    // pass the events in data to mk, returns false when data is not
+    // a complete event stream of this version.
+    static bool replay(const uint8_t *p, size_t size, regkeymaker& mk)
+    {
+        if (size<13 || memcmp(p, "HVRC", 4)!=0 || get32le(p+4)!=VERSION)
+            return false;
+        if (p[size-5]!='E' || get32le(p+size-4)!=size)
+            return false;
+        reader r(p+8, size-8-5);
+        while (!r.eof()) {
+            switch(r.byte()) {
+                case 'K': mk.newkey(r.path()); break;
+                case 'V': {
+                    std::string name= r.string();
+                    ValueType_t type= r.dword();
+                    std::string data= r.string();
+                    mk.setval(name, RegistryValue(type, ByteVector(data.begin(), data.end())));
+                    break;
+                }
+                case 'D': mk.deletekey(r.path()); break;
+                case 'X': mk.deleteval(r.string()); break;
+                default: throw "regevents: invalid event";
+            }
+        }
+        return true;
+    }
+};
+#endif
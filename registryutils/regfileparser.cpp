@@ -2,9 +2,14 @@
 #include "vectorutils.h"
 #include "stringutils.h"
 #include "regfileparser.h"
+#include "mappedfile.h"
+#include "utfconvert.h"
+#include "phasestats.h"
+#include <memory>
+#include <algorithm>
 
 
-size_t findendquote(const std::string& str, size_t pos, char quotechar)
+size_t findendquote(std::string_view str, size_t pos, char quotechar)
 {
     bool bEscaped= false;
     while (pos<str.size())
@@ -25,25 +30,93 @@ size_t findendquote(const std::string& str, size_t pos, char quotechar)
     }
     return std::string::npos;
 }
-bool ReadLine(FILE *f, std::string& line)
-{
-    line.erase();
-    line.resize(65536);
+// splits a memory mapped file into lines, of any length.
+//
+// the encoding is detected from the byte order mark: utf-16 files are
+// converted to utf-8 in large blocks, utf-8 files are read directly
+// from the mapping.
+class linereader {
+    mappedfile _file;
 
-    char *p= fgets(&line[0], line.size(), f);
-    if (p==NULL) {
-        line.erase();
-        return false;
+    // the input not yet converted
+    const uint8_t *_in;
+    const uint8_t *_inend;
+    enum { UTF8, UTF16LE, UTF16BE } _encoding;
+    std::string _buf;
+
+    // the utf-8 text not yet returned
+    const char *_p;
+    const char *_end;
+
+    enum { BLOCKSIZE= 0x100000 };
+
+    // convert the next block, keeping the unreturned text.
+    // returns false when all input was converted.
+    bool fill()
+    {
+        if (_in==_inend)
+            return false;
+        _buf.erase(0, _p-_buf.data());
+
+        size_t n= std::min(size_t(_inend-_in), size_t(BLOCKSIZE));
+        _in += utf16toutf8(_in, n, _encoding==UTF16BE, _in+n==_inend, _buf);
+
+        _p= _buf.data();
+        _end= _p+_buf.size();
+        return true;
     }
-    line.resize(stringlength(p));
-    // todo: handle long lines ( > 65536 )
-    //  - read until line has EOLN
+public:
+    linereader(const std::string& filename)
+        : _file(filename), _in(_file.data()), _inend(_in+_file.size()), _encoding(UTF8)
+    {
+        if (_inend-_in>=2 && _in[0]==0xff && _in[1]==0xfe) {
+            _encoding= UTF16LE;
+            _in += 2;
+        }
+        else if (_inend-_in>=2 && _in[0]==0xfe && _in[1]==0xff) {
+            _encoding= UTF16BE;
+            _in += 2;
+        }
+        else if (_inend-_in>=3 && _in[0]==0xef && _in[1]==0xbb && _in[2]==0xbf) {
+            _in += 3;
+        }
 
-    while (line.size() && (line[line.size()-1]=='\r' || line[line.size()-1]=='\n')) {
-        line.resize(line.size()-1);
+        if (_encoding==UTF8) {
+            _p= (const char*)_in;
+            _end= (const char*)_inend;
+            _in= _inend;
+        }
+        else {
+            _p= _end= _buf.data();
+        }
     }
-    return true;
-}
+    // returns the next line, without the line terminator
+    bool next(std::string_view& line)
+    {
+        // note: memchr is vectorized in all common c libraries
+        size_t searched= 0;
+        const char *eol= NULL;
+        while (true) {
+            if (_p+searched<_end)
+                eol= (const char*)memchr(_p+searched, '\n', _end-_p-searched);
+            if (eol)
+                break;
+            searched= _end-_p;
+            if (!fill())
+                break;
+        }
+        if (_p==_end)
+            return false;
+        if (eol==NULL)
+            eol= _end;
+        line= std::string_view(_p, eol-_p);
+        _p= eol==_end ? _end : eol+1;
+
+        while (line.size() && (line.back()=='\r' || line.back()=='\n'))
+            line.remove_suffix(1);
+        return true;
+    }
+};
 bool IsSetSpec(const std::string& spec)
 {
     if (spec[0]!=':')
@@ -67,7 +140,7 @@ bool IsSetSpec(const std::string& spec)
     }
     return true;
 }
-std::string GetNameFromSetSpec(const std::string& spec, size_t start)
+std::string GetNameFromSetSpec(std::string_view spec, size_t start)
 {
     if (spec[start]=='\'' || spec[start]=='\"')
     {
@@ -75,15 +148,15 @@ std::string GetNameFromSetSpec(const std::string& spec, size_t start)
         //debug("GetNameFromSetSpec:%s\n", spec.substr(1, endquote-3).c_str());
 
         //todo: check for missing quote.
-        return cstrunescape(spec.substr(start+1, endquote-start-2));
+        return cstrunescape(std::string(spec.substr(start+1, endquote-start-2)));
     }
     size_t eqpos= spec.find('=');
 
     //debug("GetNameFromSetSpec:%s\n", spec.substr(1,eqpos-1).c_str());
-    return spec.substr(start,eqpos-start);
+    return std::string(spec.substr(start,eqpos-start));
 }
 
-std::string GetValueSpecFromSetSpec(const std::string& spec, size_t start)
+std::string_view GetValueSpecFromSetSpec(std::string_view spec, size_t start)
 {
     if (spec[start]=='\'' || spec[start]=='\"')
     {
@@ -114,17 +187,23 @@ void stripbom(std::string& line)
 #ifndef _WIN32_WCE
 bool ProcessRegFile(const std::string& filename, regkeymaker& mk)
 {
-    FILE *f= fopen(filename.c_str(), "r");
-    if (f==NULL) {
-        perror(filename.c_str());
+    STATS_PHASE_DETAIL(PARSE, filename);
+    std::shared_ptr<linereader> f;
+    try {
+        f.reset(new linereader(filename));
+    }
+    catch(const std::string& msg) {
+        fprintf(stderr, "%s\n", msg.c_str());
         return false;
     }
 
+    // note: line is reused, so long lines and continuations don't reallocate
     std::string line;
+    std::string_view rawline;
 
-// note: not yet handling linecontinuations
-// note: not yet handling utf-16LE encoded files
-    while (ReadLine(f, line)) {
+    while (f->next(rawline)) {
+        STATS_BYTES(PARSE, rawline.size()+1);
+        line.assign(rawline);
         // remove trailing whitespace
         while (line.size() && isspace(line[line.size()-1])) {
             line.resize(line.size()-1);
@@ -136,8 +215,11 @@ bool ProcessRegFile(const std::string& filename, regkeymaker& mk)
             continue;
         else if (line=="REGEDIT4")
             continue;
+        else if (line[0]=='[' && line[1]=='-' && line[line.size()-1]==']') {
+            mk.deletekey(RegistryPath::FromKeySpec(std::string_view(line).substr(2, line.size()-3)));
+        }
         else if (line[0]=='[' && line[line.size()-1]==']') {
-            mk.newkey(RegistryPath::FromKeySpec(line.substr(1, line.size()-2)));
+            mk.newkey(RegistryPath::FromKeySpec(std::string_view(line).substr(1, line.size()-2)));
         }
         else if (line[0]==';') {
             // skip comments.
@@ -159,26 +241,28 @@ bool ProcessRegFile(const std::string& filename, regkeymaker& mk)
                         line.resize(line.size()-1);
                     }
                 }
-                std::string continuedline;
-                if (!ReadLine(f, continuedline))
+                std::string_view continuedline;
+                if (!f->next(continuedline))
                     break;
                 // trim whitespace
-                continuedline.erase(0, continuedline.find_first_not_of(" \t"));
-                while (continuedline.size() && isspace(continuedline[continuedline.size()-1])) {
-                    continuedline.resize(continuedline.size()-1);
+                continuedline.remove_prefix(std::min(continuedline.find_first_not_of(" \t"), continuedline.size()));
+                while (continuedline.size() && isspace((uint8_t)continuedline.back())) {
+                    continuedline.remove_suffix(1);
                 }
 
-                line += continuedline;
+                line.append(continuedline);
             }
-            std::string valuespec= GetValueSpecFromSetSpec(line, 0);
+            std::string_view valuespec= GetValueSpecFromSetSpec(line, 0);
 
-            //debug("valline: %hs  = %hs\n", valuename.c_str(), valuespec.c_str());
+            //debug("valline: %hs  = %hs\n", valuename.c_str(), std::string(valuespec).c_str());
 
-            mk.setval(valuename, RegistryValue::FromValueSpec(valuespec));
+            if (valuespec=="-")
+                mk.deleteval(valuename);
+            else
+                mk.setval(valuename, RegistryValue::FromValueSpec(valuespec));
         }
     }
 
-    fclose(f);
     return true;
 }
 #endif
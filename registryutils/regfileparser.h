@@ -1,19 +1,25 @@
 #ifndef _REG_FILEPARSER_H_
 #define _REG_FILEPARSER_H_
 #include <string>
+#include <string_view>
 #include <vectorutils.h>
 
 #include "regvalue.h"
 #include "regpath.h"
 
-size_t findendquote(const std::string& str, size_t pos, char quotechar);
+size_t findendquote(std::string_view str, size_t pos, char quotechar);
 bool IsSetSpec(const std::string& spec);
-std::string GetNameFromSetSpec(const std::string& spec, size_t start);
-std::string GetValueSpecFromSetSpec(const std::string& spec, size_t start);
+std::string GetNameFromSetSpec(std::string_view spec, size_t start);
+// note: returns a view into spec
+std::string_view GetValueSpecFromSetSpec(std::string_view spec, size_t start);
 
 struct regkeymaker {
     virtual void newkey(const RegistryPath& path)= 0;
     virtual void setval(const std::string& name, const RegistryValue& value)= 0;
+
+    // [-KEY] and "name"=- lines, only makers which modify existing keys support these
+    virtual void deletekey(const RegistryPath&) { throw std::string("key deletion not supported"); }
+    virtual void deleteval(const std::string&) { throw std::string("value deletion not supported"); }
 };
 bool ProcessRegFile(const std::string& filename, regkeymaker& mk);
 #endif
@@ -2,6 +2,7 @@
 #define _REG_PATH_H_
 
 #include "stringutils.h"
+#include <string_view>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -21,12 +22,13 @@ typedef uint32_t HKEY;
 #endif
 class RegistryPath {
 public:
-    static RegistryPath FromKeySpec(const std::string& keyspec)
+    static RegistryPath FromKeySpec(std::string_view keyspec)
     {
         HKEY hRoot;
         std::string path;
 
         size_t slashpos= keyspec.find_first_of("/\\");
+        std::string_view rootname= keyspec.substr(0, slashpos);
 
         // 0x80000000 HKEY_CLASSES_ROOT        hkcr
         // 0x80000001 HKEY_CURRENT_USER        hkcu
@@ -38,54 +40,44 @@ public:
         // 0x80000050 HKEY_PERFORMANCE_TEXT    hkpt
         // 0x80000060 HKEY_PERFORMANCE_NLSTEXT hkpn
         //
-        if (stringicompare(keyspec.substr(0,slashpos), std::string("hkcr"))==0)
-            hRoot= HKEY_CLASSES_ROOT;
-        else if (stringicompare(keyspec.substr(0,slashpos), std::string("hkey_classes_root"))==0)
-            hRoot= HKEY_CLASSES_ROOT;
-        else if (stringicompare(keyspec.substr(0,slashpos), std::string("hkcu"))==0)
-            hRoot= HKEY_CURRENT_USER;
-        else if (stringicompare(keyspec.substr(0,slashpos), std::string("hkey_current_user"))==0)
-            hRoot= HKEY_CURRENT_USER;
-        else if (stringicompare(keyspec.substr(0,slashpos), std::string("hklm"))==0)
-            hRoot= HKEY_LOCAL_MACHINE;
-        else if (stringicompare(keyspec.substr(0,slashpos), std::string("hkey_local_machine"))==0)
-            hRoot= HKEY_LOCAL_MACHINE;
-        else if (stringicompare(keyspec.substr(0,slashpos), std::string("hku"))==0)
-            hRoot= HKEY_USERS;
-        else if (stringicompare(keyspec.substr(0,slashpos), std::string("hkey_users"))==0)
-            hRoot= HKEY_USERS;
+        static const struct { const char *name; HKEY root; } roots[]= {
+            { "hkcr", HKEY_CLASSES_ROOT },
+            { "hkey_classes_root", HKEY_CLASSES_ROOT },
+            { "hkcu", HKEY_CURRENT_USER },
+            { "hkey_current_user", HKEY_CURRENT_USER },
+            { "hklm", HKEY_LOCAL_MACHINE },
+            { "hkey_local_machine", HKEY_LOCAL_MACHINE },
+            { "hku", HKEY_USERS },
+            { "hkey_users", HKEY_USERS },
 #ifdef HKEY_PERFORMANCE_DATA
-        else if (stringicompare(keyspec.substr(0,slashpos), std::string("hkpd"))==0)
-            hRoot= HKEY_PERFORMANCE_DATA;
-        else if (stringicompare(keyspec.substr(0,slashpos), std::string("hkey_performance_data"))==0)
-            hRoot= HKEY_PERFORMANCE_DATA;
+            { "hkpd", HKEY_PERFORMANCE_DATA },
+            { "hkey_performance_data", HKEY_PERFORMANCE_DATA },
 #endif
 #ifdef HKEY_CURRENT_CONFIG
-        else if (stringicompare(keyspec.substr(0,slashpos), std::string("hkcc"))==0)
-            hRoot= HKEY_CURRENT_CONFIG;
-        else if (stringicompare(keyspec.substr(0,slashpos), std::string("hkey_current_config"))==0)
-            hRoot= HKEY_CURRENT_CONFIG;
+            { "hkcc", HKEY_CURRENT_CONFIG },
+            { "hkey_current_config", HKEY_CURRENT_CONFIG },
 #endif
 #ifdef HKEY_DYN_DATA
-        else if (stringicompare(keyspec.substr(0,slashpos), std::string("hkdd"))==0)
-            hRoot= HKEY_DYN_DATA;
-        else if (stringicompare(keyspec.substr(0,slashpos), std::string("hkey_dyn_data"))==0)
-            hRoot= HKEY_DYN_DATA;
+            { "hkdd", HKEY_DYN_DATA },
+            { "hkey_dyn_data", HKEY_DYN_DATA },
 #endif
 #ifdef HKEY_PERFORMANCE_TEXT
-        else if (stringicompare(keyspec.substr(0,slashpos), std::string("hkpt"))==0)
-            hRoot= HKEY_PERFORMANCE_TEXT;
-        else if (stringicompare(keyspec.substr(0,slashpos), std::string("hkey_performance_text"))==0)
-            hRoot= HKEY_PERFORMANCE_TEXT;
+            { "hkpt", HKEY_PERFORMANCE_TEXT },
+            { "hkey_performance_text", HKEY_PERFORMANCE_TEXT },
 #endif
 #ifdef HKEY_PERFORMANCE_NLSTEXT
-        else if (stringicompare(keyspec.substr(0,slashpos), std::string("hkpn"))==0)
-            hRoot= HKEY_PERFORMANCE_NLSTEXT;
-        else if (stringicompare(keyspec.substr(0,slashpos), std::string("hkey_performance_nlstext"))==0)
-            hRoot= HKEY_PERFORMANCE_NLSTEXT;
+            { "hkpn", HKEY_PERFORMANCE_NLSTEXT },
+            { "hkey_performance_nlstext", HKEY_PERFORMANCE_NLSTEXT },
 #endif
-        else if (isdigit(keyspec[0])) {
-            hRoot= (HKEY)(0x80000000+strtoul(stringptr(keyspec), 0, 0));
+        };
+        size_t i= 0;
+        while (i<sizeof(roots)/sizeof(*roots) && !isrootname(rootname, roots[i].name))
+            i++;
+
+        if (i<sizeof(roots)/sizeof(*roots))
+            hRoot= roots[i].root;
+        else if (!keyspec.empty() && isdigit((uint8_t)keyspec[0])) {
+            hRoot= (HKEY)(0x80000000+strtoul(std::string(rootname).c_str(), 0, 0));
         }
         else
             hRoot= HKEY_LOCAL_MACHINE;
@@ -186,6 +178,16 @@ public:
             return RegistryPath(m_hRoot);
     }
 private:
+    // case insensitive compare with a lowercase root name
+    static bool isrootname(std::string_view str, const char *name)
+    {
+        size_t i= 0;
+        for ( ; i<str.size() && name[i] ; i++)
+            if (tolower((uint8_t)str[i])!=name[i])
+                return false;
+        return i==str.size() && name[i]==0;
+    }
+
         HKEY m_hRoot;
         std::string m_path;
 };
@@ -2,21 +2,167 @@
 
 #ifndef _WIN32_WCE
 
-#define SQUOTEESC  "[^'\\\\]|\\\\'"
-#define DQUOTEESC  "[^\"\\\\]|\\\\\""
-#define SDQUOTEESC  "[^\"'\\\\]|\\\\'|\\\\\""
-#define STRESCAPES "\\\\[\\\\0rtn]|\\\\x[0-9a-fA-F][0-9a-fA-F]"
-
-const CHARREGEX RegistryValue::reDwordPattern= CHARREGEX("(dword|bit|bin|bitmask|dec|oct):\\s*(\\w+)", REGEX_CONSTANTS::icase);
-const CHARREGEX RegistryValue::reStringPattern_s=         CHARREGEX("^\\s*(?:(string|sz|mui_sz|expand\\w+):)?'((?:" SQUOTEESC "|" STRESCAPES ")*)'", REGEX_CONSTANTS::icase);
-const CHARREGEX RegistryValue::reStringPattern_d=        CHARREGEX("^\\s*(?:(string|sz|mui_sz|expand\\w+):)?\"((?:" DQUOTEESC "|" STRESCAPES ")*)\"", REGEX_CONSTANTS::icase);
-
-// unquoted stringtypes:
-const CHARREGEX RegistryValue::reStringPattern_n= CHARREGEX("^\\s*(string|sz|mui_sz|expand\\w*):((?:" SDQUOTEESC "|" STRESCAPES ")*?)", REGEX_CONSTANTS::icase);
-
-const CHARREGEX RegistryValue::reMultiPartStringPattern_s=    CHARREGEX("'((?:" SQUOTEESC "|" STRESCAPES ")*)'", REGEX_CONSTANTS::icase);
-const CHARREGEX RegistryValue::reMultiPartStringPattern_d= CHARREGEX("\"((?:" DQUOTEESC "|" STRESCAPES ")*)\"", REGEX_CONSTANTS::icase);
-const CHARREGEX RegistryValue::reMultiStringPattern= CHARREGEX("^\\s*multi_sz:\\s*(.*?)", REGEX_CONSTANTS::icase);
-const CHARREGEX RegistryValue::reBinaryPattern= CHARREGEX("^\\s*hex(?:\\((\\w+)\\))?:\\s*(.*?)", REGEX_CONSTANTS::icase);
-const CHARREGEX RegistryValue::reFilePattern= CHARREGEX("^\\s*file(?:\\((\\w+)\\))?:\\s*(.*?)", REGEX_CONSTANTS::icase);
+// note: these implement the value spec grammar which used to be matched
+// with regular expressions, \s and \w are the C locale classes.
+
+namespace {
+bool isspacechar(char c)
+{
+    return c==' ' || c=='\t' || c=='\n' || c=='\v' || c=='\f' || c=='\r';
+}
+bool iswordchar(char c)
+{
+    return (c>='0' && c<='9') || (c>='a' && c<='z') || (c>='A' && c<='Z') || c=='_';
+}
+bool ishexchar(char c)
+{
+    return (c>='0' && c<='9') || (c>='a' && c<='f') || (c>='A' && c<='F');
+}
+size_t skipspaces(std::string_view str, size_t pos)
+{
+    while (pos<str.size() && isspacechar(str[pos]))
+        pos++;
+    return pos;
+}
+// case insensitive compare with a lowercase name
+bool isname(std::string_view str, const char *name)
+{
+    size_t i= 0;
+    for ( ; i<str.size() && name[i] ; i++)
+        if (tolower((uint8_t)str[i])!=name[i])
+            return false;
+    return i==str.size() && name[i]==0;
+}
+bool iswordstring(std::string_view str)
+{
+    for (char c : str)
+        if (!iswordchar(c))
+            return false;
+    return !str.empty();
+}
+// like '.*', any string without line terminators
+bool isrestofline(std::string_view str)
+{
+    return str.find_first_of("\r\n")==str.npos;
+}
+// (string|sz|mui_sz|expand\w+), or with expand\w* when emptyexpand is set
+bool isstringtype(std::string_view type, bool emptyexpand)
+{
+    if (isname(type, "string") || isname(type, "sz") || isname(type, "mui_sz"))
+        return true;
+    if (type.size()<6 || !isname(type.substr(0, 6), "expand"))
+        return false;
+    if (type.size()==6)
+        return emptyexpand;
+    return iswordstring(type.substr(6));
+}
+}
+
+size_t RegistryValue::ScanEscapedString(std::string_view str, size_t pos, char quote)
+{
+    while (pos<str.size())
+    {
+        char c= str[pos];
+        if (quote ? c==quote : (c=='\'' || c=='\"'))
+            return pos;
+        if (c!='\\') {
+            pos++;
+            continue;
+        }
+        // escapes: \\ \0 \r \t \n \xHH and the quote
+        if (pos+1==str.size())
+            return str.npos;
+        char e= str[pos+1];
+        if (quote ? e==quote : (e=='\'' || e=='\"'))
+            pos += 2;
+        else if (e=='\\' || e=='0' || tolower((uint8_t)e)=='r' || tolower((uint8_t)e)=='t' || tolower((uint8_t)e)=='n')
+            pos += 2;
+        else if (tolower((uint8_t)e)=='x' && pos+3<str.size() && ishexchar(str[pos+2]) && ishexchar(str[pos+3]))
+            pos += 4;
+        else
+            return str.npos;
+    }
+    return quote ? str.npos : pos;
+}
+
+bool RegistryValue::MatchDwordSpec(std::string_view spec, std::string_view& type, std::string_view& valstr)
+{
+    size_t colon= spec.find(':');
+    if (colon==spec.npos)
+        return false;
+    type= spec.substr(0, colon);
+    if (!isname(type, "dword") && !isname(type, "bit") && !isname(type, "bin")
+            && !isname(type, "bitmask") && !isname(type, "dec") && !isname(type, "oct"))
+        return false;
+    valstr= spec.substr(skipspaces(spec, colon+1));
+    return iswordstring(valstr);
+}
+
+bool RegistryValue::MatchQuotedStringSpec(std::string_view spec, char quote, std::string_view& type, std::string_view& escstr)
+{
+    size_t pos= skipspaces(spec, 0);
+    type= std::string_view();
+    if (pos<spec.size() && spec[pos]!=quote) {
+        size_t colon= spec.find(':', pos);
+        if (colon==spec.npos)
+            return false;
+        type= spec.substr(pos, colon-pos);
+        if (!isstringtype(type, false))
+            return false;
+        pos= colon+1;
+    }
+    if (pos==spec.size() || spec[pos]!=quote)
+        return false;
+    size_t endquote= ScanEscapedString(spec, pos+1, quote);
+    if (endquote!=spec.size()-1)
+        return false;
+    escstr= spec.substr(pos+1, endquote-pos-1);
+    return true;
+}
+
+bool RegistryValue::MatchUnquotedStringSpec(std::string_view spec, std::string_view& type, std::string_view& escstr)
+{
+    size_t pos= skipspaces(spec, 0);
+    size_t colon= spec.find(':', pos);
+    if (colon==spec.npos)
+        return false;
+    type= spec.substr(pos, colon-pos);
+    if (!isstringtype(type, true))
+        return false;
+    if (ScanEscapedString(spec, colon+1, 0)!=spec.size())
+        return false;
+    escstr= spec.substr(colon+1);
+    return true;
+}
+
+bool RegistryValue::MatchMultiStringSpec(std::string_view spec, std::string_view& multistr)
+{
+    size_t pos= skipspaces(spec, 0);
+    if (!isname(spec.substr(pos, 9), "multi_sz:"))
+        return false;
+    multistr= spec.substr(skipspaces(spec, pos+9));
+    return isrestofline(multistr);
+}
+
+bool RegistryValue::MatchTaggedSpec(std::string_view spec, const char *tag, std::string_view& typestr, std::string_view& data)
+{
+    size_t pos= skipspaces(spec, 0);
+    size_t taglen= strlen(tag);
+    if (!isname(spec.substr(pos, taglen), tag))
+        return false;
+    pos += taglen;
+
+    typestr= std::string_view();
+    if (pos<spec.size() && spec[pos]=='(') {
+        size_t endparen= spec.find(')', pos);
+        if (endparen!=spec.npos && iswordstring(spec.substr(pos+1, endparen-pos-1))) {
+            typestr= spec.substr(pos+1, endparen-pos-1);
+            pos= endparen+1;
+        }
+    }
+    if (pos==spec.size() || spec[pos]!=':')
+        return false;
+    data= spec.substr(skipspaces(spec, pos+1));
+    return isrestofline(data);
+}
 #endif
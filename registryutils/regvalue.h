@@ -5,39 +5,10 @@
 #include "debug.h"
 #include "FileFunctions.h"
 #include "util/endianutil.h"
+#include "phasestats.h"
 
 
-#ifndef _WIN32_WCE
-#if !defined(USE_BOOST_REGEX) && !defined(USE_STD_REGEX)
-#error "defined either USE_BOOST_REGEX or USE_STD_REGEX"
-#endif
-#ifdef USE_BOOST_REGEX
-#include <boost/regex.hpp>
-#define BASIC_REGEX boost::basic_regex
-#define CHARREGEX   boost::regex
-#define REGEX_ITER  boost::regex_iterator
-#define REGEX_MATCH boost::regex_match
-#define REGEX_SEARCH boost::regex_search
-#define REGEX_CONSTANTS boost::regex_constants
-#define SMATCH      boost::smatch
-#define PARTIALARG  , boost::match_partial
-#endif
-
-#ifdef USE_STD_REGEX
-#include <regex>
-#define BASIC_REGEX std::basic_regex
-#define CHARREGEX   std::regex
-#define REGEX_ITER  std::regex_iterator
-#define REGEX_MATCH std::regex_match
-#define REGEX_SEARCH std::regex_search
-#define REGEX_CONSTANTS std::regex_constants
-#define SMATCH      std::smatch
-#define PARTIALARG
-#endif
-
-
-#endif
-
+#include <string_view>
 #include <map>
 
 #ifndef REG_NONE
@@ -93,15 +64,28 @@ public:
 
 #ifndef _WIN32_WCE
 private:
-    const static CHARREGEX reDwordPattern;
-    const static CHARREGEX reStringPattern_s;  // single quoted string
-    const static CHARREGEX reStringPattern_d;  // double quoted string
-    const static CHARREGEX reStringPattern_n;  // tagged string unquoted
-    const static CHARREGEX reMultiPartStringPattern_s;
-    const static CHARREGEX reMultiPartStringPattern_d;
-    const static CHARREGEX reMultiStringPattern;
-    const static CHARREGEX reBinaryPattern;
-    const static CHARREGEX reFilePattern;
+    // matchers for the parts of a value spec, implemented in regvalue.cpp.
+    // each one checks that the whole spec has the form given in the comment,
+    // like a regex_match, and returns the captured parts as views into spec.
+    // letters in type names match case insensitive.
+
+    //   (dword|bit|bin|bitmask|dec|oct):\s*(\w+)
+    static bool MatchDwordSpec(std::string_view spec, std::string_view& type, std::string_view& valstr);
+    //   \s*(?:(string|sz|mui_sz|expand\w+):)?'(escaped)'   - with quote ' or "
+    //   type is empty when not present.
+    static bool MatchQuotedStringSpec(std::string_view spec, char quote, std::string_view& type, std::string_view& escstr);
+    //   \s*(string|sz|mui_sz|expand\w*):(escaped)          - without unescaped quotes
+    static bool MatchUnquotedStringSpec(std::string_view spec, std::string_view& type, std::string_view& escstr);
+    //   \s*multi_sz:\s*(.*)
+    static bool MatchMultiStringSpec(std::string_view spec, std::string_view& multistr);
+    //   \s*TAG(?:\((\w+)\))?:\s*(.*)                       - for TAG hex or file
+    static bool MatchTaggedSpec(std::string_view spec, const char *tag, std::string_view& typestr, std::string_view& data);
+
+    // returns the position of the closing quote of an escaped string starting at pos,
+    // or npos when the string contains an invalid escape or is not terminated.
+    // with quote==0 both ' and " must be escaped, and the position of the first
+    // unescaped quote, or the end of str is returned.
+    static size_t ScanEscapedString(std::string_view str, size_t pos, char quote);
 
     enum DwordType  {
         DWTYPE_HEX=16,
@@ -123,19 +107,22 @@ public:
     }
     // this function takes an escaped string value like ab\'cd\"ef\"\n
     // and converts it to a REG_SZ : { "ab'cd\"ef\"\n" }
-    static RegistryValue FromMultiStringValue(const std::string& multistr) {
+    static RegistryValue FromMultiStringValue(std::string_view multistr) {
         StringList list;
 
-        bool bDoubleQuotes= multistr[0]=='\"';
+        char quote= (!multistr.empty() && multistr[0]=='\"') ? '\"' : '\'';
 
-        std::string::const_iterator i= multistr.begin();
-        std::string::const_iterator iend= multistr.end();
-        SMATCH what;
-        while (REGEX_SEARCH(i, iend, what, bDoubleQuotes?reMultiPartStringPattern_d:reMultiPartStringPattern_s)) {
-            std::string escstr(what[1].first, what[1].second);
-            list.push_back(cstrunescape(escstr));
+        // find each quoted string, skipping quotes which don't start a valid string
+        size_t i= 0;
+        while ((i= multistr.find(quote, i))!=multistr.npos) {
+            size_t endquote= ScanEscapedString(multistr, i+1, quote);
+            if (endquote==multistr.npos) {
+                i++;
+                continue;
+            }
+            list.push_back(cstrunescape(std::string(multistr.substr(i+1, endquote-i-1))));
 
-            i= what[0].second;
+            i= endquote+1;
         }
 
         return RegistryValue(list);
@@ -191,7 +178,16 @@ public:
         if (typestr=="resource_requirements_list") return REG_RESOURCE_REQUIREMENTS_LIST;
         if (typestr=="rrl")                        return REG_RESOURCE_REQUIREMENTS_LIST;
 
-        if (REGEX_MATCH(typestr, CHARREGEX("^\\s*[0-9]+\\s*$")))
+        size_t i= 0;
+        while (i<typestr.size() && isspace((uint8_t)typestr[i]))
+            i++;
+        size_t digits= i;
+        while (i<typestr.size() && isdigit((uint8_t)typestr[i]))
+            i++;
+        bool isnumber= i>digits;
+        while (i<typestr.size() && isspace((uint8_t)typestr[i]))
+            i++;
+        if (isnumber && i==typestr.size())
             return strtoul(typestr.c_str(), 0, 0);
 
         throw stringformat("unknown value type: %hs", typestr.c_str());
@@ -219,63 +215,44 @@ public:
         throw stringformat("unknown string format type: %hs", string_type.c_str());
     }
 
-    static RegistryValue FromValueSpec(const std::string& spec)
+    static RegistryValue FromValueSpec(std::string_view spec)
     {
-        SMATCH what;
-        if (REGEX_MATCH(spec, what, reDwordPattern)) {
-            std::string dword_type(what[1].first, what[1].second);
-            std::string valstr(what[2].first, what[2].second);
-            DwordType dwType= xlat_dword_type_string(dword_type);
-            return FromDwordValue(dwType, valstr);
+        STATS_STEP(VALUESPEC);
+        STATS_BYTES(VALUESPEC, spec.size());
+        std::string_view type, str;
+        if (MatchDwordSpec(spec, type, str)) {
+            DwordType dwType= xlat_dword_type_string(std::string(type));
+            return FromDwordValue(dwType, std::string(str));
         }
-        else if (REGEX_MATCH(spec, what, reStringPattern_s)) {
-            std::string str_type= (what[1].matched)
-                ? std::string(what[1].first, what[1].second)
-                : "sz";
-            ValueType_t dwStrType= xlat_string_type_string(str_type);
-
-            std::string escstr(what[2].first, what[2].second);
-            //printf("squoted string: type=%d / '%s'  val='%s'\n", dwStrType, str_type.c_str(), escstr.c_str());
-            return FromStringValue(dwStrType, escstr);
+        else if (MatchQuotedStringSpec(spec, '\'', type, str)) {
+            ValueType_t dwStrType= xlat_string_type_string(type.empty() ? "sz" : std::string(type));
+
+            //printf("squoted string: type=%d / '%s'  val='%s'\n", dwStrType, std::string(type).c_str(), std::string(str).c_str());
+            return FromStringValue(dwStrType, std::string(str));
         }
-        else if (REGEX_MATCH(spec, what, reStringPattern_d)) {
-            std::string str_type= (what[1].matched)
-                ? std::string(what[1].first, what[1].second)
-                : "sz";
-            ValueType_t dwStrType= xlat_string_type_string(str_type);
-
-            std::string escstr(what[2].first, what[2].second);
-            //printf("dquoted string: type=%d / '%s'  val=%s\n", dwStrType, str_type.c_str(), vhexdump(escstr).c_str());
-            return FromStringValue(dwStrType, escstr);
+        else if (MatchQuotedStringSpec(spec, '\"', type, str)) {
+            ValueType_t dwStrType= xlat_string_type_string(type.empty() ? "sz" : std::string(type));
+
+            //printf("dquoted string: type=%d / '%s'  val=%s\n", dwStrType, std::string(type).c_str(), std::string(str).c_str());
+            return FromStringValue(dwStrType, std::string(str));
         }
-        else if (REGEX_MATCH(spec, what, reStringPattern_n)) {
-            std::string str_type(what[1].first, what[1].second);
-            std::string escstr(what[2].first, what[2].second);
-            ValueType_t dwStrType= xlat_string_type_string(str_type);
-            //printf("unquoted string: type=%d / '%s'  val='%s'\n", dwStrType, str_type.c_str(), escstr.c_str());
-            return FromStringValue(dwStrType, escstr);
+        else if (MatchUnquotedStringSpec(spec, type, str)) {
+            ValueType_t dwStrType= xlat_string_type_string(std::string(type));
+            //printf("unquoted string: type=%d / '%s'  val='%s'\n", dwStrType, std::string(type).c_str(), std::string(str).c_str());
+            return FromStringValue(dwStrType, std::string(str));
         }
-        else if (REGEX_MATCH(spec, what, reMultiStringPattern)) {
-            std::string multistr(what[1].first, what[1].second);
-            return FromMultiStringValue(multistr);
+        else if (MatchMultiStringSpec(spec, str)) {
+            return FromMultiStringValue(str);
         }
-        else if (REGEX_MATCH(spec, what, reBinaryPattern)) {
-            std::string typestr= (what[1].matched)
-                ? std::string(what[1].first, what[1].second)
-                : "3";
-            std::string hexdata(what[2].first, what[2].second);
-            ValueType_t dwValueType= typestr_to_valuetype(typestr);
-            return FromBinaryValue(dwValueType, hexdata);
+        else if (MatchTaggedSpec(spec, "hex", type, str)) {
+            ValueType_t dwValueType= typestr_to_valuetype(type.empty() ? "3" : std::string(type));
+            return FromBinaryValue(dwValueType, std::string(str));
         }
-        else if (REGEX_MATCH(spec, what, reFilePattern)) {
-            std::string typestr= (what[1].matched)
-                ? std::string(what[1].first, what[1].second)
-                : "3";
-            std::string filename(what[2].first, what[2].second);
-            ValueType_t dwValueType= typestr_to_valuetype(typestr);
-            return FromFile(dwValueType, filename);
+        else if (MatchTaggedSpec(spec, "file", type, str)) {
+            ValueType_t dwValueType= typestr_to_valuetype(type.empty() ? "3" : std::string(type));
+            return FromFile(dwValueType, std::string(str));
         }
-        throw stringformat("unimplemented valuespec: '%hs'\ndid you escape all backslashes?", spec.c_str());
+        throw stringformat("unimplemented valuespec: '%hs'\ndid you escape all backslashes?", std::string(spec).c_str());
     }
 #endif
 
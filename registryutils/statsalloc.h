@@ -0,0 +1,31 @@
+#ifndef _STATS_ALLOC_H_
+#define _STATS_ALLOC_H_
+// counts heap allocations, for hvtool --stats and hvbench.
+//
+// this replaces the global operator new and delete, so it must be included
+// in exactly one source file of a program. allocations are only counted
+// while allocstats::enabled is set.
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+
+struct allocstats {
+    static inline bool enabled= false;
+    static inline std::atomic<uint64_t> count;
+};
+
+void *operator new(size_t size)
+{
+    if (allocstats::enabled)
+        allocstats::count++;
+    if (void *p= malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+#endif
@@ -0,0 +1,159 @@
+#ifndef _UTF_CONVERT_H_
+#define _UTF_CONVERT_H_
+#include <string>
+#include <stdint.h>
+#include <string.h>
+#include "vectorutils.h"
+
+// conversion between utf-16 and utf-8 text, with a fast path for ascii text.
+//
+// converts n bytes of utf-16 at p to utf-8, appending to out.
+// returns the nr of bytes converted: when not last, this is less than n
+// when the input ends in the middle of a code unit or of a surrogate pair.
+// when last, a trailing odd byte is dropped, and unpaired surrogates are
+// always converted as if they were characters.
+inline size_t utf16toutf8(const uint8_t *p, size_t n, bool bigendian, bool last, std::string& out)
+{
+    size_t outstart= out.size();
+    out.resize(outstart + n/2*3);
+    char *q= out.data()+outstart;
+
+    // the bits which must be clear in 4 ascii code units
+    static const uint8_t lemask[8]= { 0x80, 0xff, 0x80, 0xff, 0x80, 0xff, 0x80, 0xff };
+    static const uint8_t bemask[8]= { 0xff, 0x80, 0xff, 0x80, 0xff, 0x80, 0xff, 0x80 };
+    uint64_t mask;
+    memcpy(&mask, bigendian ? bemask : lemask, 8);
+    int lo= bigendian ? 1 : 0;
+
+    size_t i= 0;
+    while (i+1<n)
+    {
+        // 4 code units at a time while the text is ascii
+        while (i+8<=n) {
+            uint64_t v;
+            memcpy(&v, p+i, 8);
+            if (v&mask)
+                break;
+            q[0]= p[i+lo];
+            q[1]= p[i+lo+2];
+            q[2]= p[i+lo+4];
+            q[3]= p[i+lo+6];
+            q += 4;
+            i += 8;
+        }
+        if (i+1>=n)
+            break;
+
+        uint32_t c= bigendian ? (p[i]<<8 | p[i+1]) : (p[i] | p[i+1]<<8);
+        if (c>=0xd800 && c<0xdc00) {
+            if (i+3>=n) {
+                if (!last)
+                    break;
+            }
+            else {
+                uint32_t c2= bigendian ? (p[i+2]<<8 | p[i+3]) : (p[i+2] | p[i+3]<<8);
+                if (c2>=0xdc00 && c2<0xe000) {
+                    c= 0x10000 + ((c-0xd800)<<10) + (c2-0xdc00);
+                    i += 2;
+                }
+            }
+        }
+        i += 2;
+
+        if (c<0x80) {
+            *q++ = c;
+        }
+        else if (c<0x800) {
+            *q++ = 0xc0 | (c>>6);
+            *q++ = 0x80 | (c&0x3f);
+        }
+        else if (c<0x10000) {
+            *q++ = 0xe0 | (c>>12);
+            *q++ = 0x80 | ((c>>6)&0x3f);
+            *q++ = 0x80 | (c&0x3f);
+        }
+        else {
+            *q++ = 0xf0 | (c>>18);
+            *q++ = 0x80 | ((c>>12)&0x3f);
+            *q++ = 0x80 | ((c>>6)&0x3f);
+            *q++ = 0x80 | (c&0x3f);
+        }
+    }
+    out.resize(q-out.data());
+
+    if (last)
+        return n;
+    return i;
+}
+
+// converts n bytes of utf-8 at p to utf-16le, appending to out.
+// characters above U+FFFF become surrogate pairs. bytes which are not part
+// of a valid utf-8 sequence are converted as if they were latin-1.
+inline void utf8toutf16le(const char *p, size_t n, ByteVector& out)
+{
+    size_t outstart= out.size();
+    out.resize(outstart + n*2);
+    uint8_t *q= out.data()+outstart;
+    const uint8_t *s= (const uint8_t*)p;
+
+    size_t i= 0;
+    while (i<n)
+    {
+        // 8 bytes at a time while the text is ascii
+        while (i+8<=n) {
+            uint64_t v;
+            memcpy(&v, s+i, 8);
+            if (v&0x8080808080808080ULL)
+                break;
+            for (int j=0 ; j<8 ; j++) {
+                q[2*j]= s[i+j];
+                q[2*j+1]= 0;
+            }
+            q += 16;
+            i += 8;
+        }
+        if (i==n)
+            break;
+
+        uint32_t c= s[i];
+        size_t len= 1;
+        if (c>=0xc2 && c<0xe0 && i+1<n && (s[i+1]&0xc0)==0x80) {
+            c= ((c&0x1f)<<6) | (s[i+1]&0x3f);
+            len= 2;
+        }
+        else if (c>=0xe0 && c<0xf0 && i+2<n && (s[i+1]&0xc0)==0x80 && (s[i+2]&0xc0)==0x80) {
+            uint32_t c3= ((c&0x0f)<<12) | ((s[i+1]&0x3f)<<6) | (s[i+2]&0x3f);
+            if (c3>=0x800) {
+                c= c3;
+                len= 3;
+            }
+        }
+        else if (c>=0xf0 && c<0xf5 && i+3<n && (s[i+1]&0xc0)==0x80 && (s[i+2]&0xc0)==0x80 && (s[i+3]&0xc0)==0x80) {
+            uint32_t c4= ((c&0x07)<<18) | ((s[i+1]&0x3f)<<12) | ((s[i+2]&0x3f)<<6) | (s[i+3]&0x3f);
+            if (c4>=0x10000 && c4<0x110000) {
+                c= c4;
+                len= 4;
+            }
+        }
+        i += len;
+
+        if (c>=0x10000) {
+            uint32_t hi= 0xd800 + ((c-0x10000)>>10);
+            uint32_t lo= 0xdc00 + ((c-0x10000)&0x3ff);
+            q[0]= hi; q[1]= hi>>8;
+            q[2]= lo; q[3]= lo>>8;
+            q += 4;
+        }
+        else {
+            q[0]= c; q[1]= c>>8;
+            q += 2;
+        }
+    }
+    out.resize(q-out.data());
+}
+inline void utf8toutf16le(const std::string& str, ByteVector& out)
+{
+    utf8toutf16le(str.data(), str.size(), out);
+}
+
+#endif
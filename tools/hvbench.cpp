@@ -0,0 +1,273 @@
+// benchmark of the hive decode, dump, .reg parse and build stages, over
+// generated hives of a configurable shape. the results are written as json,
+// for tracking performance between releases.
+//
+// each stage is run ROUNDS times, the fastest round is reported, with the
+// nr of heap allocations of the first round.
+#include <sys/stat.h>
+#include <chrono>
+#include <hvfile.h>
+#include <hvdump.h>
+#include <regevents.h>
+#include <mappedfile.h>
+#include "args.h"
+#include "reggen.h"
+// count heap allocations, to report allocations per entry
+#include <statsalloc.h>
+
+struct stageresult {
+    std::string name;
+    double seconds;
+    uint64_t items;     // entries, keys or values processed per round
+    uint64_t bytes;     // input or output bytes per round
+    uint64_t allocs;
+};
+
+class benchmark {
+    int _rounds;
+    std::vector<stageresult> _results;
+public:
+    benchmark(int rounds) : _rounds(rounds) { }
+
+    // run fn _rounds times, fn returns the nr of bytes processed
+    template<typename FN>
+    void measure(const std::string& name, uint64_t items, FN fn)
+    {
+        stageresult r;
+        r.name= name;
+        r.items= items;
+        r.seconds= 1e30;
+        for (int i=0 ; i<_rounds ; i++) {
+            uint64_t nallocs= allocstats::count;
+            auto t0= std::chrono::steady_clock::now();
+            r.bytes= fn();
+            auto t1= std::chrono::steady_clock::now();
+            if (i==0)
+                r.allocs= allocstats::count-nallocs;
+            r.seconds= std::min(r.seconds, std::chrono::duration<double>(t1-t0).count());
+        }
+        fprintf(stderr, "%-20s %8.3f ms  %12.0f items/s  %8.1f MB/s  %6.2f allocs/item\n", name.c_str(),
+                r.seconds*1e3, r.items/r.seconds, r.bytes/r.seconds/1e6, double(r.allocs)/std::max(r.items, uint64_t(1)));
+        _results.push_back(r);
+    }
+
+    void writejson(FILE *f, const hiveshape& shape, uint64_t filesize, uint64_t nentries)
+    {
+        fprintf(f, "{\n");
+        fprintf(f, "  \"shape\": { \"depth\": %u, \"fanout\": %u, \"values\": %u, \"topkeys\": %u, \"seed\": %" PRIu64 " },\n",
+                shape.depth, shape.fanout, shape.values, shape.topkeys, shape.seed);
+        fprintf(f, "  \"rounds\": %d,\n", _rounds);
+        fprintf(f, "  \"filesize\": %" PRIu64 ",\n", filesize);
+        fprintf(f, "  \"entries\": %" PRIu64 ",\n", nentries);
+        fprintf(f, "  \"stages\": [\n");
+        for (unsigned i=0 ; i<_results.size() ; i++) {
+            auto& r= _results[i];
+            fprintf(f, "    { \"name\": \"%s\", \"seconds\": %.6f, \"items\": %" PRIu64 ", \"bytes\": %" PRIu64 ", "
+                    "\"items_per_s\": %.0f, \"mb_per_s\": %.3f, \"allocs_per_item\": %.3f }%s\n",
+                    r.name.c_str(), r.seconds, r.items, r.bytes, r.items/r.seconds, r.bytes/r.seconds/1e6,
+                    double(r.allocs)/std::max(r.items, uint64_t(1)), i+1<_results.size() ? "," : "");
+        }
+        fprintf(f, "  ]\n");
+        fprintf(f, "}\n");
+    }
+};
+
+// counts the keys and values
+struct countingmaker : regkeymaker {
+    uint64_t nkeys= 0;
+    uint64_t nvalues= 0;
+    virtual void newkey(const RegistryPath&) { nkeys++; }
+    virtual void setval(const std::string&, const RegistryValue&) { nvalues++; }
+};
+
+uint64_t filesize(const std::string& filename)
+{
+    struct stat st;
+    if (::stat(filename.c_str(), &st)==-1)
+        throw stringformat("%s: %s", filename.c_str(), strerror(errno));
+    return st.st_size;
+}
+
+void usage()
+{
+    printf("Usage: hvbench [-d DEPTH] [-f FANOUT] [-n VALUES] [-t TOPKEYS] [-s SEED] [-r ROUNDS] [-j N] [-T TMPDIR] [-o JSONFILE]\n");
+    printf("   -d DEPTH     levels of subkeys below each top level key, default 4\n");
+    printf("   -f FANOUT    subkeys per key, default 4\n");
+    printf("   -n VALUES    values per key, default 4\n");
+    printf("   -t TOPKEYS   nr of top level keys, default 2\n");
+    printf("   -r ROUNDS    run each stage ROUNDS times, and report the fastest, default 5\n");
+    printf("   -j N         threads used by save, default 1\n");
+    printf("   -T TMPDIR    directory for the generated .reg and .hv files, default .\n");
+    printf("   -o JSONFILE  write the results to JSONFILE instead of stdout\n");
+}
+
+int main(int argc, char**argv)
+{
+    allocstats::enabled= true;
+    hiveshape shape;
+    int rounds= 5;
+    unsigned nthreads= 1;
+    std::string tmpdir= ".";
+    std::string jsonfile;
+
+    try {
+    for (int i=1 ; i<argc ; i++)
+    {
+        if (argv[i][0]=='-') switch(argv[i][1])
+        {
+            case 'd': shape.depth= strtoul(getstrarg(argv, i, argc), 0, 0); break;
+            case 'f': shape.fanout= strtoul(getstrarg(argv, i, argc), 0, 0); break;
+            case 'n': shape.values= strtoul(getstrarg(argv, i, argc), 0, 0); break;
+            case 't': shape.topkeys= strtoul(getstrarg(argv, i, argc), 0, 0); break;
+            case 's': shape.seed= strtoull(getstrarg(argv, i, argc), 0, 0); break;
+            case 'r': rounds= std::max(1, atoi(getstrarg(argv, i, argc))); break;
+            case 'j': nthreads= strtoul(getstrarg(argv, i, argc), 0, 0); break;
+            case 'T': getarg(argv, i, argc, tmpdir); break;
+            case 'o': getarg(argv, i, argc, jsonfile); break;
+            default:
+                      usage();
+                      return 1;
+        }
+        else {
+            usage();
+            return 1;
+        }
+    }
+    std::string regfile= tmpdir+"/hvbench.reg";
+    std::string hvfile= tmpdir+"/hvbench.hv";
+    std::string dumpfile= tmpdir+"/hvbench.out";
+
+    {
+        outputbuffer out(regfile);
+        regwriter writer(out);
+        reggenerator(shape).generate(writer);
+        out.flush();
+    }
+
+    benchmark bench(rounds);
+
+    // .reg parsing, without building a hive
+    countingmaker counts;
+    ProcessRegFile(regfile, counts);
+    uint64_t regsize= filesize(regfile);
+    bench.measure("parse", counts.nkeys+counts.nvalues, [&]() {
+        countingmaker mk;
+        if (!ProcessRegFile(regfile, mk))
+            throw "parse failed";
+        return regsize;
+    });
+
+    // the value specs alone
+    StringList specs;
+    {
+        ReadWriter_ptr r(new FileReader(regfile, FileReader::readonly));
+        ByteVector text;
+        vectorread8(r, text, r->size());
+        std::string_view s((const char*)text.data(), text.size());
+        size_t pos= 0;
+        while (pos<s.size()) {
+            size_t eol= s.find('\n', pos);
+            if (eol==s.npos)
+                eol= s.size();
+            // regwriter writes each value on a single line
+            if (s.substr(pos, 2)==" \"")
+                specs.push_back(std::string(GetValueSpecFromSetSpec(s.substr(pos, eol-pos), 1)));
+            pos= eol+1;
+        }
+    }
+    uint64_t specbytes= 0;
+    for (auto& spec : specs)
+        specbytes += spec.size();
+    bench.measure("valuespec", specs.size(), [&]() {
+        for (auto& spec : specs)
+            RegistryValue::FromValueSpec(spec);
+        return specbytes;
+    });
+
+    // CreateKey and SetValue, replaying the parsed events
+    regevents events;
+    ProcessRegFile(regfile, events);
+    events.close();
+    bench.measure("make", counts.nkeys+counts.nvalues, [&]() {
+        hvmaker mk;
+        regevents::replay(events.data().data(), events.data().size(), mk);
+        return uint64_t(events.data().size());
+    });
+
+    // encoding and writing the hive
+    hvmaker mk;
+    regevents::replay(events.data().data(), events.data().size(), mk);
+    bench.measure("save", counts.nkeys+counts.nvalues+1, [&]() {
+        mk.save(ReadWriter_ptr(new FileReader(hvfile, FileReader::createnew)), nthreads);
+        return filesize(hvfile);
+    });
+
+    mappedfile img(hvfile);
+
+    // header and section enumeration
+    uint64_t nentries= 0;
+    {
+        HvFile hv(img.data(), img.size());
+        DwordVector entryofs;
+        hv.buildindex(entryofs);
+        nentries= std::count_if(entryofs.begin(), entryofs.end(), [](uint32_t ofs) { return ofs!=0; });
+    }
+    bench.measure("open", nentries, [&]() {
+        HvFile hv(img.data(), img.size());
+        DwordVector entryofs;
+        hv.buildindex(entryofs);
+        return img.size();
+    });
+
+    // readentry, per entry type
+    struct record {
+        const uint8_t *p;
+        size_t maxsize;
+        uint32_t ofs;
+        uint8_t flag;
+    };
+    std::map<std::string, std::vector<record>> bytype;
+    {
+        HvFile hv(img.data(), img.size());
+        hv.enumfilerecords([&](const uint8_t *p, size_t maxsize, uint32_t ofs, uint8_t flag) {
+            // readentry returns NULL for unknown entry types
+            ent::entry_ptr e= ent::base::readentry(p, maxsize, ofs, flag);
+            bytype[e ? e->typestr() : "unknown"].push_back(record{p, maxsize, ofs, flag});
+        });
+    }
+    for (auto& t : bytype) {
+        auto& recs= t.second;
+        bench.measure("readentry."+t.first, recs.size(), [&]() {
+            uint64_t bytes= 0;
+            for (auto& rec : recs)
+                bytes += ent::base::readentry(rec.p, rec.maxsize, rec.ofs, rec.flag) ? get32le(rec.p)&0x0fffffff : 0;
+            return bytes;
+        });
+    }
+
+    // .reg output, from the decoded table
+    hivetable tab(img.data(), HvFile(img.data(), img.size()).maxentries());
+    HvFile(img.data(), img.size()).loadtable(tab, 1);
+    bench.measure("dump", nentries, [&]() {
+        {
+            outputbuffer out(dumpfile);
+            regdumper(tab, out).dumproot();
+        }
+        return filesize(dumpfile);
+    });
+
+    if (jsonfile.empty())
+        bench.writejson(stdout, shape, img.size(), nentries);
+    else {
+        FILE *json= fopen(jsonfile.c_str(), "w");
+        if (json==NULL)
+            throw stringformat("%s: %s", jsonfile.c_str(), strerror(errno));
+        bench.writejson(json, shape, img.size(), nentries);
+        fclose(json);
+    }
+    }
+    catch(const char*msg) { fprintf(stderr, "ERROR: %s\n", msg); return 1; }
+    catch(const std::string& msg) { fprintf(stderr, "ERROR: %s\n", msg.c_str()); return 1; }
+    catch(...) { fprintf(stderr, "unknown error\n"); return 1; }
+    return 0;
+}
@@ -0,0 +1,163 @@
+// generates synthetic hives and .reg files, with a controlled shape:
+// depth, fanout, values per key, value type mix, name and payload lengths,
+// and total size. the output only depends on the options and the seed.
+//
+// the .reg text is streamed while generating, so its size is not limited by
+// memory. the .hv is built in memory, its size is limited by the format:
+// 0xfff sections of 0x400 entries, and 28 bit entry offsets.
+#include <hvfile.h>
+#include <hvdump.h>
+#include "args.h"
+#include "reggen.h"
+
+// passes the keys and values to several makers
+struct teemaker : regkeymaker {
+    std::vector<regkeymaker*> makers;
+    virtual void newkey(const RegistryPath& path)
+    {
+        for (auto mk : makers)
+            mk->newkey(path);
+    }
+    virtual void setval(const std::string& name, const RegistryValue& value)
+    {
+        for (auto mk : makers)
+            mk->setval(name, value);
+    }
+};
+
+// parse a size with an optional k, m or g suffix
+uint64_t parsesize(const char *str)
+{
+    char *end;
+    uint64_t n= strtoull(str, &end, 0);
+    switch(*end) {
+        case 'k': case 'K': return n<<10;
+        case 'm': case 'M': return n<<20;
+        case 'g': case 'G': return n<<30;
+        case 0: return n;
+    }
+    throw stringformat("invalid size: %s", str);
+}
+// parse MIN-MAX, or a single number
+void parserange(const char *str, unsigned& lo, unsigned& hi)
+{
+    char *end;
+    lo= hi= strtoul(str, &end, 0);
+    if (*end=='-')
+        hi= strtoul(end+1, &end, 0);
+    if (*end || hi<lo)
+        throw stringformat("invalid range: %s", str);
+}
+// parse the value type weights: sz=4,dword=2,binary=2,multi_sz=1,mui_sz=0
+void parsetypemix(const std::string& spec, unsigned *weights)
+{
+    static const char *names[hiveshape::NTYPES]= { "sz", "dword", "binary", "multi_sz", "mui_sz" };
+    std::fill(weights, weights+hiveshape::NTYPES, 0);
+    size_t pos= 0;
+    while (pos<spec.size()) {
+        size_t comma= spec.find(',', pos);
+        if (comma==spec.npos)
+            comma= spec.size();
+        std::string item= spec.substr(pos, comma-pos);
+        size_t eq= item.find('=');
+        int type= std::find(names, names+hiveshape::NTYPES, item.substr(0, eq))-names;
+        if (eq==item.npos || type==hiveshape::NTYPES)
+            throw stringformat("invalid type weight: %s", item.c_str());
+        weights[type]= strtoul(item.c_str()+eq+1, 0, 0);
+        pos= comma+1;
+    }
+    if (std::count(weights, weights+hiveshape::NTYPES, 0)==hiveshape::NTYPES)
+        throw "all type weights are 0";
+}
+
+void usage()
+{
+    printf("Usage: hvgen [options] [-r REGFILE] [-o HVFILE]\n");
+    printf("   -d DEPTH     levels of subkeys below each top level key, default 4\n");
+    printf("   -f FANOUT    subkeys per key, default 4\n");
+    printf("   -n VALUES    values per key, default 4\n");
+    printf("   -t TOPKEYS   nr of top level keys, default 2\n");
+    printf("   -s SEED      random seed, default 1\n");
+    printf("   -m MIX       value type weights, default sz=4,dword=2,binary=2,multi_sz=1,mui_sz=0\n");
+    printf("   -l MIN-MAX   key and value name length, default 4-12\n");
+    printf("   -p MIN-MAX   string and binary payload length, default 4-48\n");
+    printf("   -N ENTRIES   stop after ENTRIES keys and values\n");
+    printf("   -S SIZE      stop when the estimated hive size reaches SIZE, with k, m or g suffix\n");
+    printf("   -j N         encode the hive using N threads, 0 = one per cpu\n");
+    printf("   -r REGFILE   write the .reg text to REGFILE\n");
+    printf("   -o HVFILE    write the hive to HVFILE\n");
+}
+
+int main(int argc, char**argv)
+{
+    hiveshape shape;
+    std::string regfile;
+    std::string hvfile;
+    unsigned nthreads= 1;
+
+    try {
+    for (int i=1 ; i<argc ; i++)
+    {
+        if (argv[i][0]=='-') switch(argv[i][1])
+        {
+            case 'd': shape.depth= strtoul(getstrarg(argv, i, argc), 0, 0); break;
+            case 'f': shape.fanout= strtoul(getstrarg(argv, i, argc), 0, 0); break;
+            case 'n': shape.values= strtoul(getstrarg(argv, i, argc), 0, 0); break;
+            case 't': shape.topkeys= strtoul(getstrarg(argv, i, argc), 0, 0); break;
+            case 's': shape.seed= strtoull(getstrarg(argv, i, argc), 0, 0); break;
+            case 'm': parsetypemix(getstrarg(argv, i, argc), shape.typeweights); break;
+            case 'l': parserange(getstrarg(argv, i, argc), shape.minnamelen, shape.maxnamelen); break;
+            case 'p': parserange(getstrarg(argv, i, argc), shape.minpayload, shape.maxpayload); break;
+            case 'N': shape.maxentries= parsesize(getstrarg(argv, i, argc)); break;
+            case 'S': shape.maxsize= parsesize(getstrarg(argv, i, argc)); break;
+            case 'j': nthreads= strtoul(getstrarg(argv, i, argc), 0, 0);
+                      if (nthreads==0)
+                          nthreads= std::thread::hardware_concurrency();
+                      break;
+            case 'r': getarg(argv, i, argc, regfile); break;
+            case 'o': getarg(argv, i, argc, hvfile); break;
+            default:
+                      usage();
+                      return 1;
+        }
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if (regfile.empty() && hvfile.empty()) {
+        usage();
+        return 1;
+    }
+    // value payloads have a 16 bit size
+    if (shape.maxpayload>0x7000 || shape.maxnamelen>0x4000)
+        throw "name or payload too long";
+
+    teemaker tee;
+    std::shared_ptr<outputbuffer> out;
+    std::shared_ptr<regwriter> writer;
+    if (!regfile.empty()) {
+        out.reset(new outputbuffer(regfile));
+        writer.reset(new regwriter(*out));
+        tee.makers.push_back(writer.get());
+    }
+    std::shared_ptr<hvmaker> mk;
+    if (!hvfile.empty()) {
+        mk.reset(new hvmaker);
+        tee.makers.push_back(mk.get());
+    }
+
+    reggenerator gen(shape);
+    gen.generate(tee);
+    if (out)
+        out->flush();
+    if (mk)
+        mk->save(ReadWriter_ptr(new FileReader(hvfile, FileReader::createnew)), nthreads);
+
+    printf("generated %" PRIu64 " keys and values, estimated hive size %" PRIu64 "\n", gen.nentries(), gen.size());
+    }
+    catch(const char*msg) { printf("ERROR: %s\n", msg); return 1; }
+    catch(const std::string& msg) { printf("ERROR: %s\n", msg.c_str()); return 1; }
+    catch(...) { printf("unknown error\n"); return 1; }
+    return 0;
+}
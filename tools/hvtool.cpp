@@ -1,1155 +1,1418 @@
 #include "util/ReadWriter.h"
-#include "util/rw/MmapReader.h"
 #include "util/rw/MemoryReader.h"
 #include "crypto/hash.h"
 #include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
 #include "vectorutils.h"
 #include "util/chariterators.h"
 #include <memory>
 #include <functional>
 #include <map>
+#include <array>
+#include <random>
+#include <unordered_map>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <algorithm>
+#include <cinttypes>
+#include <sys/stat.h>
 #include <regpath.h>
 #include <regvalue.h>
 #include <regfileparser.h>
-
-#include "args.h"
-
-#ifndef _WIN32
-typedef uint32_t HKEY;
-#endif
-
-int g_verbose;
-
-template<typename PTR>
-size_t vectorread32le(PTR rd, DwordVector& v, size_t n)
-{
-    v.resize(n);
-
-    size_t nr= rd->read((uint8_t*)&v[0], n*sizeof(uint32_t));
-    if (nr%sizeof(uint32_t))
-        throw "read partial uint32_t";
-    v.resize(nr/sizeof(uint32_t));
-#if __BYTE_ORDER == __BIG_ENDIAN
-#ifdef __GXX_EXPERIMENTAL_CXX0X__
-    std::for_each(v.begin(), v.end(), [](uint32_t& x) { x= swab32(x);});
-#else
-    throw "need c++0x";
-#endif
-#endif
-    return v.size();
-}
-
-template<typename PTR>
-size_t vectorread8(PTR rd, ByteVector& v, size_t n)
-{
-	v.resize(n);
-	size_t nr= rd->read((uint8_t*)&v[0], n);
-	v.resize(nr);
-	return v.size();
-}
-template<typename PTR>
-size_t readutf16le(PTR rd, std::Wstring& v, size_t n)
-{
-    v.resize(n);
-    size_t nr= rd->read((uint8_t*)&v[0], n*sizeof(uint16_t));
-    if (nr%sizeof(uint16_t))
-        throw "read partial uint16_t";
-    v.resize(nr/sizeof(uint16_t));
-    v.resize(stringlength(&v[0]));
-#if __BYTE_ORDER == __BIG_ENDIAN
-#ifdef __GXX_EXPERIMENTAL_CXX0X__
-    std::for_each(v.begin(), v.end(), [](uint16_t& x) { x= swab16(x);});
-#else
-    throw "need c++0x";
-#endif
-#endif
-
-    return v.size();
-}
-template<typename PTR>
-    void vectorwrite32le(PTR wr, const DwordVector& v)
-    {
-        for (DwordVector::const_iterator i= v.begin() ; i!=v.end() ; ++i)
-            wr->write32le(*i);
-    }
-template<typename PTR>
-    void writeutf16le(PTR wr, const std::Wstring& v)
-    {
-#if __BYTE_ORDER == __BIG_ENDIAN
-#ifdef __GXX_EXPERIMENTAL_CXX0X__
-        std::for_each(v.begin(), v.end(), [this](uint16_t x) { wr->write16le(x); });
+#include <phasestats.h>
+#ifdef WITH_STATS
+// count heap allocations for --stats
+#include <statsalloc.h>
+#ifdef _WIN32
+#include <psapi.h>
 #else
-        throw "need c++0x";
+#include <sys/resource.h>
 #endif
-#else  // __LITTLE_ENDIAN
-        wr->write((const uint8_t*)v.c_str(), v.size()*sizeof(uint16_t));
 #endif
-    }
+#include <mappedfile.h>
+#include <utfconvert.h>
+#include <hvfile.h>
+#include <hvdump.h>
+#include <regevents.h>
 
+#include "args.h"
 
-namespace ent {
-
-class base;
-typedef std::shared_ptr<base> entry_ptr;
-    class roots;
-    class key;
-    class value;
-    class database;
-    class record;
-    class recordmore;
-    class index;
-    class volume;
-
-    class stringvalue;
-    class binaryvalue;
-    class dwordvalue;
-    class stringlistvalue;
-    class muistringvalue;
-
+// applies .reg files to an existing hive file, in place.
+//
+// existing entries are never moved or re-encoded: new keys and values are
+// appended to the end of the file, with their id taken from a free slot in a
+// section offset block, or from a new section when all are full. only the
+// link pointing to a new entry, in its parent or previous sibling, is
+// rewritten. replaced and deleted entries are unlinked, and keep their slot.
+// finish updates the filesize and filemd5 in the header.
+class hvpatcher : public regkeymaker {
+    ReadWriter_ptr _w;
+    DwordVector _sections;  // section offsets, relative to 0x5000
+    unsigned _freesection;  // the section where the last free slot was found
+    uint64_t _end;          // new entries are appended here
+    uint32_t _curkey;       // 0 when not in a key, id 0 is the roots entry
+    unsigned _nchanges;
+
+    // entries don't move, so links, positions and names are read only once
+    std::unordered_map<uint64_t,uint32_t> _dwords;
+    std::unordered_map<uint32_t,uint64_t> _entrypos;
+    std::unordered_map<uint64_t,std::string> _names;
+
+    enum { SLOTS= 12, COUNT= 12+0x1000 };
+    // link fields, relative to the start of an entry
+    enum { NEXTLINK= 12, CHILDLINK= 16, VALUELINK= 20, ROOTLINK= 12 };
+
+    uint32_t read32(uint64_t pos)
+    {
+        auto i= _dwords.find(pos);
+        if (i!=_dwords.end())
+            return i->second;
+        _w->setpos(pos);
+        return _dwords[pos]= _w->read32le();
+    }
+    void write32(uint64_t pos, uint32_t x)
+    {
+        _w->setpos(pos);
+        _w->write32le(x);
+        _dwords[pos]= x;
+    }
+    // the file position of entry id
+    uint64_t entrypos(uint32_t id)
+    {
+        auto i= _entrypos.find(id);
+        if (i!=_entrypos.end())
+            return i->second;
+        if (id/0x400 >= _sections.size())
+            throw stringformat("invalid entry id %08x", id);
+        uint32_t slot= read32(0x5000+_sections[id/0x400]+SLOTS+4*(id%0x400));
+        if ((slot&3)!=1 || (slot&0x0ffffffc) >= _end-0x5000)
+            throw stringformat("entry %08x not allocated", id);
+        return _entrypos[id]= 0x5000+(slot&0x0ffffffc);
+    }
+    // the name of the key or value at pos
+    const std::string& entryname(uint64_t pos)
+    {
+        auto i= _names.find(pos);
+        if (i!=_names.end())
+            return i->second;
+        ByteVector hdr(12+16);
+        _w->setpos(pos);
+        if (_w->read(hdr.data(), hdr.size())!=hdr.size())
+            throw "read error";
+        size_t namlen;
+        switch(get32le(&hdr[0])>>28) {
+            case ent::ET_KEY:   namlen= hdr[24]; pos += 12+16; break;
+            case ent::ET_VALUE: namlen= get16le(&hdr[20]); pos += 12+10; break;
+            default: throw stringformat("@%08x: not a key or value", uint32_t(pos-0x5000));
+        }
+        ByteVector wname(namlen*2);
+        _w->setpos(pos);
+        wname.resize(_w->read(wname.data(), wname.size()));
+        return _names[pos]= decodeutf16le(wname.data(), wname.size()/2);
+    }
+    // a key or value chain, indexed by folded name hash
+    struct chain {
+        std::unordered_multimap<uint64_t,uint32_t> ids;
+        std::unordered_map<uint32_t,uint64_t> linkto;   // id -> position of the link to it
+        uint64_t lastlink;                              // the link ending the chain
+    };
+    std::unordered_map<uint64_t,chain> _chains;         // by position of the head link
 
-typedef std::map<uint32_t,entry_ptr> entrymap_t;
-class base : public MemoryReader {
-    uint32_t _id;  // note: this id is not orred with 0x20000000
-protected:
-    ByteVector _data;
-public:
-    base(uint32_t id)
-        : _id(id)
-    {
-    }
-    base(uint32_t id, const ByteVector& data)
-        : _id(id), _data(data)
+    // the chain starting at the link at headpos, read on first use
+    chain& getchain(uint64_t headpos)
     {
-        setbuf(&_data.front(), _data.size());
-    }
-    virtual uint16_t entrytype()= 0;
-    virtual const char*typestr()=0;
-    static entry_ptr readentry(ReadWriter_ptr r, uint32_t ofs, uint8_t flag);
-
-    uint32_t id() { return _id&0x0fffffff; }
+        auto i= _chains.find(headpos);
+        if (i!=_chains.end())
+            return i->second;
+        chain& c= _chains[headpos];
+        uint64_t linkpos= headpos;
+        for (unsigned n=0 ; n<_sections.size()*0x400 ; n++)
+        {
+            uint32_t id= read32(linkpos)&0x0fffffff;
+            if (!id) {
+                c.lastlink= linkpos;
+                return c;
+            }
+            uint64_t pos= entrypos(id);
+            c.ids.emplace(foldednamehash(entryname(pos)), id);
+            c.linkto.emplace(id, linkpos);
+            linkpos= pos+NEXTLINK;
+        }
+        throw "loop in key or value chain";
+    }
+    // the first entry in c named name, or 0
+    uint32_t findinchain(chain& c, const std::string& name)
+    {
+        auto range= c.ids.equal_range(foldednamehash(name));
+        uint32_t found= 0;
+        for (auto i= range.first ; i!=range.second ; ++i)
+            if (foldednameequal(entryname(entrypos(i->second)), name) && (!found || c.linkto[i->second]<c.linkto[found]))
+                found= i->second;
+        return found;
+    }
+    // link the new entry id, named name, at the end of c
+    void appendtochain(chain& c, uint32_t id, const std::string& name)
+    {
+        write32(c.lastlink, link(id));
+        c.ids.emplace(foldednamehash(name), id);
+        c.linkto[id]= c.lastlink;
+        c.lastlink= entrypos(id)+NEXTLINK;
+    }
+    // unlink old from c, and link the new entry id, named name, in its place.
+    // when id is 0, old is only removed.
+    void replaceinchain(chain& c, uint32_t old, uint32_t id, const std::string& name)
+    {
+        uint64_t linkpos= c.linkto[old];
+        uint32_t next= read32(entrypos(old)+NEXTLINK);
+        write32(linkpos, id ? link(id) : next);
+
+        auto range= c.ids.equal_range(foldednamehash(entryname(entrypos(old))));
+        for (auto i= range.first ; i!=range.second ; ++i)
+            if (i->second==old) {
+                c.ids.erase(i);
+                break;
+            }
+        c.linkto.erase(old);
 
-    std::string readwstr(size_t n)
-    {
-        std::Wstring w;
-        readutf16le(this, w, n);
-        return ToString(w);
+        if (id) {
+            c.ids.emplace(foldednamehash(name), id);
+            c.linkto[id]= linkpos;
+            linkpos= entrypos(id)+NEXTLINK;
+        }
+        // the link to the next entry moved
+        if (next&0x0fffffff)
+            c.linkto[next&0x0fffffff]= linkpos;
+        else
+            c.lastlink= linkpos;
     }
-    virtual void save(ReadWriter_ptr w)= 0;
-
-    roots* asroots();
-    key* askey();
-    value* asvalue();
-
-    void savehead(ReadWriter_ptr w, uint32_t savesize)
+    // find a free id, the slots past the count of a section are free.
+    // the count is stored as 0 when the section is full.
+    uint32_t allocid()
     {
-        w->write32le( (entrytype()<<28) | savesize);
-        w->write32le(0);
-        w->write32le(_id);
+        for (unsigned i=0 ; i<_sections.size() ; i++)
+        {
+            unsigned n= (_freesection+i)%_sections.size();
+            uint64_t sectpos= 0x5000+_sections[n];
+            uint32_t count= read32(sectpos+COUNT);
+            if (count<0x400 && (read32(sectpos+SLOTS+4*count)&3)!=1) {
+                _freesection= n;
+                write32(sectpos+COUNT, count+1<0x400 ? count+1 : 0);
+                return n*0x400+count;
+            }
+        }
+        // append a new section, with all slots free
+        unsigned n= _sections.size();
+        if (n>=HvFile::MAXSECTIONS)
+            throw "section table is full";
+        ByteVector sect;
+        BV_AppendDword(sect, 0x20001004);
+        BV_AppendDword(sect, 0);
+        BV_AppendDword(sect, n);
+        for (unsigned j= 0 ; j<0x400 ; j++)
+            BV_AppendDword(sect, j<0x3ff ? (j+1)*0x40000 : 0);
+        BV_AppendDword(sect, 1);
+        if (_end-0x5000+sect.size() > HvFile::MAXOFFSET)
+            throw "hive too large";
+        _w->setpos(_end);
+        _w->write(sect.data(), sect.size());
+        write32(0x1000+4*n, _end-0x5000);
+
+        _sections.push_back(_end-0x5000);
+        _freesection= n;
+        _end += sect.size();
+        return n*0x400;
+    }
+    // append entry e, whose id was taken from allocid
+    void append(ent::base& e)
+    {
+        ByteVector data;
+        e.save(data);
+        // entry offsets are stored in 28 bits
+        if (_end-0x5000+data.size() > HvFile::MAXOFFSET)
+            throw "hive too large";
+        _w->setpos(_end);
+        _w->write(data.data(), data.size());
+        write32(0x5000+_sections[e.id()/0x400]+SLOTS+4*(e.id()%0x400), (_end-0x5000)|1);
+        _end += data.size();
+        _nchanges++;
+    }
+    static uint32_t link(uint32_t id) { return id ? (id|0x20000000) : 0; }
+
+    // the link to the first key of the hive of path
+    uint64_t rootlink(const RegistryPath& path)
+    {
+        int root= int(path.GetRoot())&255;
+        if (root>=8 || path.GetPath().empty())
+            throw stringformat("invalid key: %s\\%s", path.GetRootName().c_str(), path.GetPath().c_str());
+        return entrypos(0)+ROOTLINK+4*root;
+    }
+    // find the key at path, creating the missing keys when create is set.
+    // parent receives the chain containing the key.
+    uint32_t findkey(const RegistryPath& path, bool create, chain **parent)
+    {
+        uint64_t headpos= rootlink(path);
+        std::string p= path.GetPath();
+        size_t start= 0;
+        while (true)
+        {
+            size_t end= p.find('\\', start);
+            if (end==p.npos)
+                end= p.size();
+            std::string name= p.substr(start, end-start);
+
+            chain& c= getchain(headpos);
+            uint32_t id= findinchain(c, name);
+            if (!id) {
+                if (!create)
+                    return 0;
+                // as in a built hive, the new key is added last
+                ent::key k(allocid(), name);
+                append(k);
+                id= k.id();
+                appendtochain(c, id, name);
+            }
+            if (end==p.size()) {
+                if (parent)
+                    *parent= &c;
+                return id;
+            }
+            headpos= entrypos(id)+CHILDLINK;
+            start= end+1;
+        }
     }
-};
-    enum { HKCR, HKCU, HKLM, HKU };
-    enum {
-        ET_DATABASE=7,
-        ET_RECORD,  // 8
-        ET_RECMORE, // 9
-        ET_VOLUME,  // a
-        ET_ROOTS,   // b
-        ET_KEY,     // c
-        ET_VALUE,   // d
-        ET_INDEX    // e
-    };
-
-// type 0xb000  - have ptrs, contains pointers to start fo HKCR, HKCU, HKLM
-class roots : public base {
-    std::vector<uint32_t> _roots;
-    std::vector<uint32_t> _lasts;
 public:
-    roots(uint32_t id)
-        : base(id)
-    {
-        _roots.resize(8);
-        _lasts.resize(8);
+    hvpatcher(ReadWriter_ptr w)
+        : _w(w), _freesection(0), _curkey(0), _nchanges(0)
+    {
+        _end= _w->size();
+        if (read32(0x08)!=0x4d494b45)
+            throw "not a hive file";
+        _sections.push_back(read32(0x1000));
+        while (_sections.size()<0x1000) {
+            uint32_t sofs= read32(0x1000+4*_sections.size());
+            if (sofs==0)
+                break;
+            _sections.push_back(sofs);
+        }
+        // start looking for free slots in the last section
+        _freesection= _sections.size()-1;
     }
-    roots(uint32_t id, const ByteVector& data)
-        : base(id, data)
+    virtual void newkey(const RegistryPath& path)
     {
-        vectorread32le(this, _roots, 8);
-        _lasts.resize(8); // note: not updated
-        auto i= std::find_if(_roots.begin()+3, _roots.end(), [](uint32_t x) { return x!=0; });
-        if (i!=_roots.end())
-            printf("WARNING: more roots: %s\n", hexdump(&_roots[3], 5).c_str());
-
+        _curkey= findkey(path, true, NULL);
     }
-    virtual uint16_t entrytype() { return ET_ROOTS; }
-
-    uint32_t hiveid(HKEY root)
+    virtual void setval(const std::string& valuename, const RegistryValue& value)
     {
-        return _roots[int(root)&255]&0x0fffffff;
+        if (!_curkey)
+            throw "value outside a key";
+        chain& c= getchain(entrypos(_curkey)+VALUELINK);
+        std::string name= valuename=="@" ? "Default" : valuename;
+        uint32_t old= findinchain(c, name);
+
+        ent::value_ptr v= HvFile::makevalue(allocid(), name, value);
+        // a replaced value keeps its position in the chain
+        if (old)
+            v->nextvalue(read32(entrypos(old)+NEXTLINK)&0x0fffffff);
+        append(*v);
+        if (old)
+            replaceinchain(c, old, v->id(), name);
+        else
+            appendtochain(c, v->id(), name);
     }
-    void hiveid(HKEY root, uint32_t id)
+    virtual void deletekey(const RegistryPath& path)
     {
-        _roots[int(root)&255]= id|0x20000000;
+        _curkey= 0;
+        chain *parent;
+        uint32_t id= findkey(path, false, &parent);
+        if (!id)
+            return;
+        replaceinchain(*parent, id, 0, "");
+        _nchanges++;
     }
-    uint32_t lasthivekey(HKEY root)
+    virtual void deleteval(const std::string& valuename)
     {
-        return _lasts[int(root)&255]&0x0fffffff;
+        if (!_curkey)
+            throw "value outside a key";
+        chain& c= getchain(entrypos(_curkey)+VALUELINK);
+        uint32_t id= findinchain(c, valuename=="@" ? "Default" : valuename);
+        if (!id)
+            return;
+        replaceinchain(c, id, 0, "");
+        _nchanges++;
     }
-    void lasthivekey(HKEY root, uint32_t id)
+    // pad the file to a page boundary, and update the header
+    void finish()
     {
-        _lasts[int(root)&255]= id|0x20000000;
-    }
-
-
-    virtual const char*typestr() { return "roots"; }
+        if (_end&0xfff) {
+            ByteVector padding(0x1000-(_end&0xfff));
+            _w->setpos(_end);
+            _w->write(padding.data(), padding.size());
+            _end += padding.size();
+        }
+        write32(0x20, _end);
 
-    virtual void save(ReadWriter_ptr w)
-    {
-        savehead(w, _roots.size()*sizeof(uint32_t));
-        vectorwrite32le(w, _roots);
+        // +000c : filemd5, over everything from +00fc to the end of the file
+        Md5 m;
+        ByteVector data(0x100000);
+        _w->setpos(0xfc);
+        for (uint64_t pos= 0xfc ; pos<_end ; ) {
+            size_t n= _w->read(data.data(), std::min(uint64_t(data.size()), _end-pos));
+            if (n==0)
+                throw "read error";
+            m.add(data.data(), n);
+            pos += n;
+        }
+        ByteVector digest(16);
+        m.final(digest.data());
+        _w->setpos(0x0c);
+        _w->write(digest.data(), digest.size());
     }
+    unsigned changes() const { return _nchanges; }
 };
 
-// type 0xc000  - ptr to next sibling, first child, first value, name
-class key : public base {
-    uint32_t _nextsibling;
-    uint32_t _firstchild;
-    uint32_t _firstvalue;
-    uint32_t _lastvalue;   // not stored, just for easy tree building
-    uint32_t _lastchild;   // not stored, just for easy tree building
-    std::string _name;
+// content hashes of the key subtrees of a hive, used to compare hives.
+// the hash of a key covers its name, the names, types and payloads of its
+// values, and the hashes of its subkeys. names are folded to lower case, and
+// the order of values and subkeys does not matter, so keys with equal hashes
+// have equal contents.
+class subtreehashes {
 public:
-    key(uint32_t id, const std::string& name)
-        : base(id), _nextsibling(0), _firstchild(0), _firstvalue(0), _lastvalue(0), _lastchild(0), _name(name)
+    typedef std::array<uint8_t,16> digest;
+private:
+    hivetable& _tab;
+    std::vector<digest> _hash;      // indexed by key id
+    std::vector<bool> _visited;
+
+    static void addname(Md5& m, const char *name)
     {
+        std::string folded(name);
+        std::transform(folded.begin(), folded.end(), folded.begin(), ::tolower);
+        m.add((const uint8_t*)folded.c_str(), folded.size()+1);
     }
-    key(uint32_t id, const ByteVector& data)
-        : base(id, data)
-    {
-        _nextsibling= read32le();
-        _firstchild= read32le();
-        _firstvalue= read32le();
-
-        // note: when reading these are not updated!!
-        _lastvalue= 0;
-        _lastchild= 0;
-
-        uint8_t namlen= read8();  // max 0x44
-        /*uint8_t unusedlen=*/ read8();  // max 0x61
-        uint16_t flags= read16le();
-        if (flags && g_verbose)
-            printf("WARNING: key flags=%04x\n", flags);
-
-        _name= readwstr(namlen);
-    }
-    virtual uint16_t entrytype() { return ET_KEY; }
-    virtual const char*typestr() { return "key"; }
-    std::string name() { return _name; }
-    uint32_t nextsibling() { return _nextsibling&0x0fffffff; }
-    void nextsibling(uint32_t id) { _nextsibling= id ? (id|0x20000000) : 0; }
-    uint32_t firstchild() { return _firstchild&0x0fffffff; }
-    void firstchild(uint32_t id) { _firstchild= id ? (id|0x20000000) : 0; }
-    uint32_t firstvalue() { return _firstvalue&0x0fffffff; }
-    void firstvalue(uint32_t id) { _firstvalue= id ? (id|0x20000000) : 0; }
-
-    uint32_t lastvalue() { return _lastvalue&0x0fffffff; }
-    void lastvalue(uint32_t id) { _lastvalue= id ? (id|0x20000000) : 0; }
-    uint32_t lastchild() { return _lastchild&0x0fffffff; }
-    void lastchild(uint32_t id) { _lastchild= id ? (id|0x20000000) : 0; }
-
-
-    virtual void save(ReadWriter_ptr w)
+    digest valuehash(uint32_t id)
     {
-        std::Wstring wstr= ToWString(_name);
-        size_t padding= (wstr.size()&1) ? 2 : 0;
-        savehead(w, 16 + wstr.size()*sizeof(WCHAR)+padding);
-        w->write32le(_nextsibling);
-        w->write32le(_firstchild);
-        w->write32le(_firstvalue);
-        w->write8(wstr.size());
-        w->write8(0);
-        w->write16le(0);
-
-        writeutf16le(w, wstr);
+        Md5 m;
+        addname(m, _tab.name(id));
+        ByteVector hdr;
+        BV_AppendWord(hdr, _tab.valuetype(id));
+        BV_AppendDword(hdr, _tab.valuesize(id));
+        m.add(hdr.data(), hdr.size());
+        m.add(_tab.valuedata(id), _tab.valuesize(id));
+        digest d;
+        m.final(d.data());
+        return d;
+    }
+    // the hash of key id, all its subkeys must already be hashed
+    digest keyhash(uint32_t id)
+    {
+        std::vector<digest> values;
+        for (uint32_t v= _tab.firstvalue(id) ; v && _tab.isvalue(v) && values.size()<_hash.size() ; v= _tab.nextvalue(v))
+            values.push_back(valuehash(v));
+        std::vector<digest> children;
+        for (uint32_t c= _tab.firstchild(id) ; c && _tab.iskey(c) && children.size()<_hash.size() ; c= _tab.nextsibling(c))
+            children.push_back(_hash[c]);
+        std::sort(values.begin(), values.end());
+        std::sort(children.begin(), children.end());
 
-        if (padding)
-            w->write16le(0);
+        Md5 m;
+        addname(m, _tab.name(id));
+        ByteVector counts;
+        BV_AppendDword(counts, values.size());
+        BV_AppendDword(counts, children.size());
+        m.add(counts.data(), counts.size());
+        for (auto& d : values)
+            m.add(d.data(), d.size());
+        for (auto& d : children)
+            m.add(d.data(), d.size());
+        digest d;
+        m.final(d.data());
+        return d;
     }
-
-};
-
-//=============================================================================
-// type 0xd000 - value
-class value;
-typedef std::shared_ptr<value> value_ptr;
-
-enum { VT_STRING=1, VT_BINARY=3, VT_DWORD=4, VT_STRINGLIST=7, VT_MUI=21 };
-
-class value : public base {
-    uint32_t _nextvalue;
-    std::string _name;
 public:
-    value(uint32_t id, const std::string& name)
-        : base(id), _nextvalue(0), _name(name)
-    {
-    }
-    value(uint32_t id, uint32_t next, const std::string& name, const ByteVector& data)
-        : base(id, data), _nextvalue(next), _name(name)
-    {
+    subtreehashes(hivetable& tab, uint32_t maxentries)
+        : _tab(tab), _hash(maxentries), _visited(maxentries)
+    {
+    }
+    // hash all keys in the sibling chain starting at id, and their subtrees
+    void calc(uint32_t id)
+    {
+        // keys in preorder, so each key is hashed after its subkeys
+        // when walking the list backwards
+        DwordVector order;
+        DwordVector stack;
+        for ( ; id && _tab.iskey(id) && stack.size()<_hash.size() ; id= _tab.nextsibling(id))
+            stack.push_back(id);
+        while (!stack.empty()) {
+            id= stack.back();
+            stack.pop_back();
+            if (_visited[id])
+                continue;
+            _visited[id]= true;
+            order.push_back(id);
+            for (uint32_t c= _tab.firstchild(id) ; c && _tab.iskey(c) && !_visited[c] ; c= _tab.nextsibling(c))
+                stack.push_back(c);
+        }
+        for (auto i= order.rbegin() ; i!=order.rend() ; ++i)
+            _hash[*i]= keyhash(*i);
     }
-    uint32_t nextvalue() { return _nextvalue&0x0fffffff; }
-    void nextvalue(uint32_t id) { _nextvalue= id ? (id|0x20000000) : 0; }
+    const digest& operator[](uint32_t id) const { return _hash[id]; }
+};
 
-    virtual uint16_t entrytype() { return ET_VALUE; }
-    virtual uint16_t valuetype()= 0;
-    static value_ptr readvalue(uint32_t id, const ByteVector& data);
-    virtual const char*typestr() { return "value"; }
-    virtual std::string asstring()= 0;
-    std::string name() const { return _name; }
+// structural comparison of two decoded hives.
+//
+// keys and values are matched by case folded name. subtrees with equal
+// content hashes are skipped without visiting their children.
+// the differences are reported either as a list of added (+), removed (-)
+// and changed keys and values, or as a .reg file which changes a into b.
+class hivediff {
+    hivetable& _a;
+    hivetable& _b;
+    subtreehashes _ha;
+    subtreehashes _hb;
+    outputbuffer& out;
+    bool _asreg;
+    unsigned _ndiffs;
+
+    // a pending comparison: a key present in both, only in a, or only in b
+    struct item {
+        uint32_t aid;
+        uint32_t bid;
+        std::string path;
+        item(uint32_t aid, uint32_t bid, const std::string& path) : aid(aid), bid(bid), path(path) { }
+    };
+    std::vector<item> _stack;
 
-    virtual void encodeasbinary(ByteVector& bin)= 0;
+    // names differing only in case are duplicates, these are matched in
+    // chain order
+    typedef std::multimap<std::string,uint32_t> namemap;
 
-    virtual void save(ReadWriter_ptr w)
+    static std::string folded(const char *name)
     {
-        std::Wstring wstr= ToWString(_name);
-        ByteVector bin;
-        encodeasbinary(bin);
-
-        size_t datasize= 10 + wstr.size()*sizeof(WCHAR)+bin.size();
-        size_t padding= (datasize&3) ? 4-(datasize&3) : 0;
-        savehead(w, 10 + wstr.size()*sizeof(WCHAR)+bin.size()+padding);
-
-        w->write32le(_nextvalue);
-        w->write16le(valuetype());
-        w->write16le(bin.size());
-        w->write16le(wstr.size());
-
-        writeutf16le(w, wstr);
-        w->write(&bin.front(), bin.size());
-
-        for (unsigned i=0 ; i<padding ; i++)
-            w->write8(0);
+        std::string f(name);
+        std::transform(f.begin(), f.end(), f.begin(), ::tolower);
+        return f;
     }
-};
-class stringvalue : public value {
-    std::string _value;
-public:
-    stringvalue(uint32_t id, const std::string& name, const std::string& data)
-        : value(id, name), _value(data)
+    // add a key or value to m, reporting duplicate names
+    void addname(namemap& m, hivetable& tab, uint32_t id, const char *kind)
     {
+        std::string name= folded(tab.name(id));
+        if (m.count(name))
+            out.format("%sWARN: [%08x] duplicate %s name %s\n", _asreg ? "; " : "", id, kind, tab.name(id));
+        m.emplace(name, id);
     }
-    stringvalue(uint32_t id, uint32_t next, const std::string& name, const ByteVector& data)
-        : value(id, next, name, data)
+    // the chains are followed until an id repeats, so loops end
+    void keychain(hivetable& tab, uint32_t id, namemap& m)
     {
-        _value= readwstr(data.size()/2);
+        std::unordered_set<uint32_t> visited;
+        for ( ; id && tab.iskey(id) && visited.insert(id).second ; id= tab.nextsibling(id))
+            addname(m, tab, id, "key");
     }
-    virtual uint16_t valuetype() { return VT_STRING; }
-    std::string str()
+    void valuechain(hivetable& tab, uint32_t id, namemap& m)
     {
-        return _value;
+        std::unordered_set<uint32_t> visited;
+        for ( ; id && tab.isvalue(id) && visited.insert(id).second ; id= tab.nextvalue(id))
+            addname(m, tab, id, "value");
     }
-    virtual std::string asstring()
+    static bool samevalue(hivetable& a, uint32_t aid, hivetable& b, uint32_t bid)
     {
-        return "\""+cstrescape(_value)+"\"";
+        return a.valuetype(aid)==b.valuetype(bid) && a.valuesize(aid)==b.valuesize(bid)
+            && memcmp(a.valuedata(aid), b.valuedata(bid), a.valuesize(aid))==0;
     }
-    virtual void encodeasbinary(ByteVector& bin)
-    {
-        std::for_each(utf8adaptor(_value.begin()), utf8adaptor(_value.end()), [&bin](uint32_t v) { BV_AppendWord(bin, v); });
-        BV_AppendWord(bin, 0);
-    }
-};
-class binaryvalue : public value {
-    ByteVector _value;
-public:
-    binaryvalue(uint32_t id, const std::string& name, const ByteVector& data)
-        : value(id, name), _value(data)
-    {
-    }
-    binaryvalue(uint32_t id, uint32_t next, const std::string& name, const ByteVector& data)
-        : value(id, next, name, data)
-    {
-        _value= data;
-    }
-    virtual uint16_t valuetype() { return VT_BINARY; }
-    ByteVector bin()
-    {
-        return _value;
-    }
-    virtual std::string asstring()
-    {
-        return "hex:"+hexstring(&_value.front(), _value.size(),',');
-    }
-    virtual void encodeasbinary(ByteVector& bin)
-    {
-        bin= _value;
-    }
-};
-class dwordvalue : public value {
-    uint32_t _value;
-public:
-    dwordvalue(uint32_t id, const std::string& name, uint32_t data)
-        : value(id, name), _value(data)
-    {
-    }
-    dwordvalue(uint32_t id, uint32_t next, const std::string& name, const ByteVector& data)
-        : value(id, next, name, data)
-    {
-        _value= read32le();
-    }
-    virtual uint16_t valuetype() { return VT_DWORD; }
-    uint32_t dword()
-    {
-        return _value;
-    }
-    virtual std::string asstring()
+
+    // a key line, in a .reg file preceded by an empty line
+    void keyline(const char *prefix, const std::string& path)
     {
-        return stringformat("dword:%08x", _value);
+        if (_asreg)
+            out.append('\n');
+        out.append(prefix);
+        out.append('[');
+        out.append(path);
+        out.append("]\n", 2);
     }
-    virtual void encodeasbinary(ByteVector& bin)
+    // a value line, in a .reg file a removed value is written as "name"=-
+    void valueline(bool removed, hivetable& tab, uint32_t id)
     {
-        BV_AppendDword(bin, _value);
+        const char *name= tab.name(id);
+        // as in a dump, the values in a .reg file are indented by one space
+        out.append(!_asreg ? (removed ? "- " : "+ ") : " ", _asreg ? 1 : 2);
+        if (strcmp(name, "Default")==0)
+            out.append("@=", 2);
+        else {
+            out.append('"');
+            out.append(name);
+            out.append("\"=", 2);
+        }
+        if (removed && _asreg)
+            out.append('-');
+        else
+            tab.writevalue(out, id);
+        out.append('\n');
     }
-};
-class stringlistvalue : public value {
-    StringList _value;
-public:
-    stringlistvalue(uint32_t id, const std::string& name, const StringList& data)
-        : value(id, name), _value(data)
+
+    // report a key only in a, for a .reg file this deletes the whole subtree
+    void removedkey(const std::string& path)
     {
+        _ndiffs++;
+        if (_asreg) {
+            out.append("\n[-", 3);
+            out.append(path);
+            out.append("]\n", 2);
+        }
+        else
+            keyline("- ", path);
     }
-    stringlistvalue(uint32_t id, uint32_t next, const std::string& name, const ByteVector& data)
-        : value(id, next, name, data)
+    // report a key only in b, with all its values
+    void addedkey(uint32_t id, const std::string& path)
     {
-        std::Wstring  wstr;
-        while (!eof())
+        _ndiffs++;
+        // as in a dump, keys with subkeys are implied by their subkeys
+        if (_asreg && !_b.firstvalue(id) && _b.firstchild(id))
+            return;
+        keyline(_asreg ? "" : "+ ", path);
+        for (uint32_t v= _b.firstvalue(id) ; v && _b.isvalue(v) ; v= _b.nextvalue(v))
+            valueline(false, _b, v);
+    }
+    // report the value differences of a key present in both hives
+    void diffvalues(uint32_t aid, uint32_t bid, const std::string& path)
+    {
+        namemap av, bv;
+        valuechain(_a, _a.firstvalue(aid), av);
+        valuechain(_b, _b.firstvalue(bid), bv);
+
+        bool header= false;
+        auto diffline= [&](bool removed, hivetable& tab, uint32_t id) {
+            if (!header) {
+                keyline("", path);
+                header= true;
+            }
+            valueline(removed, tab, id);
+        };
+        auto ia= av.begin();
+        auto ib= bv.begin();
+        while (ia!=av.end() || ib!=bv.end())
         {
-            uint16_t w= read16le();
-            if (w)
-                wstr.push_back(w);
+            if (ib==bv.end() || (ia!=av.end() && ia->first<ib->first)) {
+                _ndiffs++;
+                diffline(true, _a, ia->second);
+                ++ia;
+            }
+            else if (ia==av.end() || ib->first<ia->first) {
+                _ndiffs++;
+                diffline(false, _b, ib->second);
+                ++ib;
+            }
             else {
-                _value.push_back(ToString(wstr));
-                wstr.clear();
+                if (!samevalue(_a, ia->second, _b, ib->second)) {
+                    _ndiffs++;
+                    if (!_asreg)
+                        diffline(true, _a, ia->second);
+                    diffline(false, _b, ib->second);
+                }
+                ++ia;
+                ++ib;
             }
         }
-        if (_value.back().empty())
-            _value.resize(_value.size()-1);
     }
-    virtual uint16_t valuetype() { return VT_STRINGLIST; }
-    StringList list()
+    // queue the subkeys of the chains at aid and bid, in name order
+    void pushchildren(uint32_t aid, uint32_t bid, const std::string& path)
     {
-        return _value;
-    }
-    virtual std::string asstring()
-    {
-        std::string str;
-        for (StringList::const_iterator i=_value.begin() ; i!=_value.end() ; ++i)
+        namemap ac, bc;
+        keychain(_a, aid, ac);
+        keychain(_b, bid, bc);
+
+        // merge, then push in reverse, so the stack pops them in name order
+        std::vector<item> items;
+        auto ia= ac.begin();
+        auto ib= bc.begin();
+        while (ia!=ac.end() || ib!=bc.end())
         {
-            if (!str.empty())
-                str += ", ";
-            str += "\"" + cstrescape(*i) + "\"";
+            if (ib==bc.end() || (ia!=ac.end() && ia->first<ib->first)) {
+                items.push_back(item(ia->second, 0, path+"\\"+_a.name(ia->second)));
+                ++ia;
+            }
+            else if (ia==ac.end() || ib->first<ia->first) {
+                items.push_back(item(0, ib->second, path+"\\"+_b.name(ib->second)));
+                ++ib;
+            }
+            else {
+                if (_ha[ia->second]!=_hb[ib->second])
+                    items.push_back(item(ia->second, ib->second, path+"\\"+_b.name(ib->second)));
+                ++ia;
+                ++ib;
+            }
         }
-        return "multi_sz:"+str;
+        _stack.insert(_stack.end(), items.rbegin(), items.rend());
     }
-    virtual void encodeasbinary(ByteVector& bin)
-    {
-        for (StringList::const_iterator i= _value.begin() ; i!=_value.end() ; ++i)
-        {
-            BV_AppendWString(bin, ToWString(*i));
-            BV_AppendWord(bin, 0); // add terminating (WCHAR)NUL
+public:
+    hivediff(hivetable& a, uint32_t amax, hivetable& b, uint32_t bmax, outputbuffer& out, bool asreg)
+        : _a(a), _b(b), _ha(a, amax), _hb(b, bmax), out(out), _asreg(asreg), _ndiffs(0)
+    {
+    }
+    // compare the HKCR, HKCU and HKLM trees, returns the nr of differences
+    unsigned run()
+    {
+        if (!_a.hasroots() || !_b.hasroots())
+            throw "could not find root";
+        if (_asreg)
+            out.append("REGEDIT4\n");
+
+        static const struct { int root; const char *name; } roots[]= {
+            { ent::HKCR, "HKCR" }, { ent::HKCU, "HKCU" }, { ent::HKLM, "HKLM" } };
+        for (auto& r : roots) {
+            _ha.calc(_a.hiveid(r.root));
+            _hb.calc(_b.hiveid(r.root));
+            pushchildren(_a.hiveid(r.root), _b.hiveid(r.root), r.name);
+
+            while (!_stack.empty()) {
+                item cur= _stack.back();
+                _stack.pop_back();
+                if (!cur.bid)
+                    removedkey(cur.path);
+                else if (!cur.aid) {
+                    addedkey(cur.bid, cur.path);
+                    pushchildren(0, _b.firstchild(cur.bid), cur.path);
+                }
+                else {
+                    diffvalues(cur.aid, cur.bid, cur.path);
+                    pushchildren(_a.firstchild(cur.aid), _b.firstchild(cur.bid), cur.path);
+                }
+            }
         }
-        BV_AppendWord(bin, 0); // add terminating (WCHAR)NUL
+        return _ndiffs;
     }
 };
-class muistringvalue : public value {
-    std::string _value;
-public:
-    muistringvalue(uint32_t id, const std::string& name, const std::string& data)
-        : value(id, name), _value(data)
-    {
-    }
-    muistringvalue(uint32_t id, uint32_t next, const std::string& name, const ByteVector& data)
-        : value(id, next, name, data)
-    {
-        _value= readwstr(data.size()/2);
-    }
-    virtual uint16_t valuetype() { return VT_MUI; }
-    std::string muistr()
-    {
-        return _value;
-    }
-    virtual std::string asstring()
-    {
-        return "mui_sz:\""+cstrescape(_value)+"\"";
+
+// read queries, one per line, skipping empty lines and ';' comments
+bool readqueries(const std::string& filename, StringList& queries)
+{
+    FILE *f= fopen(filename.c_str(), "r");
+    if (f==NULL) {
+        perror(filename.c_str());
+        return false;
+    }
+    char buf[65536];
+    while (fgets(buf, sizeof(buf), f)) {
+        std::string line= buf;
+        while (!line.empty() && (line[line.size()-1]=='\n' || line[line.size()-1]=='\r'))
+            line.resize(line.size()-1);
+        if (line.empty() || line[0]==';')
+            continue;
+        queries.push_back(line);
+    }
+    fclose(f);
+    return true;
+}
+// compare hive afile with bfile, returns the nr of differences
+unsigned diffhives(const std::string& afile, const std::string& bfile, outputbuffer& out, bool asreg, unsigned nthreads)
+{
+    mappedfile aimg(afile);
+    mappedfile bimg(bfile);
+    HvFile ahv(aimg.data(), aimg.size());
+    HvFile bhv(bimg.data(), bimg.size());
+
+    hivetable a(aimg.data(), ahv.maxentries());
+    ahv.loadtable(a, nthreads);
+    hivetable b(bimg.data(), bhv.maxentries());
+    bhv.loadtable(b, nthreads);
+
+    hivediff d(a, ahv.maxentries(), b, bhv.maxentries(), out, asreg);
+    return d.run();
+}
+// apply the .reg files to hive file hvfile, in place
+bool patchhive(const std::string& hvfile, const StringList& regfiles)
+{
+    hvpatcher patcher(ReadWriter_ptr(new FileReader(hvfile, FileReader::readwrite)));
+    try {
+        for (unsigned i=0 ; i<regfiles.size() ; i++) {
+            if (!ProcessRegFile(regfiles[i], patcher)) {
+                patcher.finish();
+                return false;
+            }
+        }
     }
-    virtual void encodeasbinary(ByteVector& bin)
-    {
-         BV_AppendWString(bin, ToWString(_value));
+    catch(...) {
+        // keep the header consistent with the changes made so far
+        patcher.finish();
+        throw;
     }
-};
-value_ptr value::readvalue(uint32_t id, const ByteVector& data)
+    patcher.finish();
+    if (g_verbose)
+        printf("%s: %u changes\n", hvfile.c_str(), patcher.changes());
+    return true;
+}
+// overwrite existing values of hive file hvfile in place, through a writable
+// mapping. each set is KEYPATH:VALUENAME=VALUESPEC, the new value must have the
+// same encoded size as the old one. only the entries on the paths are decoded.
+void setvalues(const std::string& hvfile, const StringList& sets)
 {
-    MemoryReader r(&data.front(), data.size());
-    uint32_t nextvalue= r.read32le();
-    uint16_t type= r.read16le();   // 1, 3, 4, 7, 21
-    uint16_t vallen= r.read16le();  // max 0xc5a
-    uint16_t namlen= r.read16le();  // max 0x75
-
-    std::Wstring w;
-    readutf16le(&r, w, namlen);
-    std::string name= ToString(w);
-
-    ByteVector valdata;
-    vectorread8(&r, valdata, vallen);
-
-    switch(type)
-    {
-        case VT_STRING: return value_ptr(new stringvalue(id, nextvalue, name, valdata));
-        case VT_BINARY: return value_ptr(new binaryvalue(id, nextvalue, name, valdata));
-        case VT_DWORD:  return value_ptr(new dwordvalue(id, nextvalue, name, valdata));
-        case VT_STRINGLIST: return value_ptr(new stringlistvalue(id, nextvalue, name, valdata));
-        case VT_MUI:    return value_ptr(new muistringvalue(id, nextvalue, name, valdata));
-        default:
-                        printf("WARNING: unsupported value type %d ( next:%08x name:%s, val:%s )\n", type, nextvalue, name.c_str(), vhexdump(valdata).c_str());
-    }
-    return value_ptr();
+    mappedfile img(hvfile, true);
+    HvFile hv(img.data(), img.size());
+    DwordVector entryofs;
+    hv.buildindex(entryofs);
+    lazyhive src(img.data(), img.size(), entryofs.data(), entryofs.size(), 4096);
+    keyindex index(src);
+
+    // locate and encode all values first, so nothing is written when one fails
+    struct change {
+        uint32_t ofs;       // of the value entry, relative to 0x5000
+        uint16_t type;
+        ByteVector data;
+    };
+    std::vector<change> changes;
+    for (auto& set : sets)
+    {
+        // the first ':' ends the key path, value names may contain '\\'
+        size_t colon= set.find(':');
+        size_t eq= colon==set.npos ? set.npos : set.find('=', colon);
+        if (eq==set.npos)
+            throw stringformat("expected KEYPATH:VALUENAME=VALUESPEC: %s", set.c_str());
+        std::string valuename= set.substr(colon+1, eq-colon-1);
+        if (valuename=="@")
+            valuename= "Default";
+
+        uint32_t keyid= index.findkey(RegistryPath::FromKeySpec(set.substr(0, colon)));
+        uint32_t id= keyid ? index.findvalue(keyid, valuename) : 0;
+        if (!id)
+            throw stringformat("value not found: %s", set.substr(0, eq).c_str());
+
+        change c;
+        c.ofs= entryofs[id];
+        ent::value_ptr v= HvFile::makevalue(id, valuename, RegistryValue::FromValueSpec(std::string_view(set).substr(eq+1)));
+        c.type= v->valuetype();
+        v->encodeasbinary(c.data);
+
+        const uint8_t *p= img.data()+0x5000+c.ofs;
+        if (c.data.size()!=get16le(p+12+6))
+            throw stringformat("%s: new value has size %d, old size is %d", set.substr(0, eq).c_str(), int(c.data.size()), get16le(p+12+6));
+        changes.push_back(c);
+    }
+
+    // value entry: header, next, type, vallen, namlen, name, payload
+    uint8_t *image= img.writabledata();
+    for (auto& c : changes)
+    {
+        uint8_t *p= image+0x5000+c.ofs;
+        p[12+4]= uint8_t(c.type);
+        p[12+5]= uint8_t(c.type>>8);
+        size_t namlen= get16le(p+12+8);
+        std::copy(c.data.begin(), c.data.end(), p+12+10+namlen*2);
+    }
+
+    // +000c : filemd5, over everything from +00fc to the end of the file
+    Md5 m;
+    m.add(image+0xfc, img.size()-0xfc);
+    m.final(image+0x0c);
+
+    img.flush();
 }
+struct dumpoptions {
+    bool raw;
+    std::string keyspec;
+    StringList queries;
+    unsigned nthreads;
 
-//=============================================================================
-
-class database : public base {
-public:
-    database(uint32_t id, const ByteVector& data)
-        : base(id, data)
-    {
-        // todo
-        printf("WARNING: database not implemented\n");
-    }
-    virtual uint16_t entrytype() { return ET_DATABASE; }
-    virtual const char*typestr() { return "database"; }
-    virtual void save(ReadWriter_ptr w) { throw "not implemented"; }
-};
-class record : public base {
-public:
-    record(uint32_t id, const ByteVector& data)
-        : base(id, data)
-    {
-        printf("WARNING: record not implemented\n");
-    }
-    virtual uint16_t entrytype() { return ET_RECORD; }
-    virtual const char*typestr() { return "record"; }
-    virtual void save(ReadWriter_ptr w) { throw "not implemented"; }
-};
-class recordmore : public base {
-public:
-    recordmore(uint32_t id, const ByteVector& data)
-        : base(id, data)
-    {
-        printf("WARNING: recordmore not implemented\n");
-    }
-    virtual uint16_t entrytype() { return ET_RECMORE; }
-    virtual const char*typestr() { return "recmore"; }
-    virtual void save(ReadWriter_ptr w) { throw "not implemented"; }
+    dumpoptions() : raw(false), nthreads(1) { }
 };
-class index : public base {
-public:
-    index(uint32_t id, const ByteVector& data)
-        : base(id, data)
-    {
-        printf("WARNING: index not implemented\n");
-    }
-    virtual uint16_t entrytype() { return ET_INDEX; }
-    virtual const char*typestr() { return "index"; }
-    virtual void save(ReadWriter_ptr w) { throw "not implemented"; }
-};
-class volume : public base {
-public:
-    volume(uint32_t id, const ByteVector& data)
-        : base(id, data)
-    {
-        printf("WARNING: volume not implemented\n");
-    }
-    virtual uint16_t entrytype() { return ET_VOLUME; }
-    virtual const char*typestr() { return "volume"; }
-    virtual void save(ReadWriter_ptr w) { throw "not implemented"; }
-};
-
-
-roots* base::asroots() { return dynamic_cast<roots*>(this); }
-key* base::askey() { return dynamic_cast<key*>(this); }
-value* base::asvalue() { return dynamic_cast<value*>(this); }
-
-entry_ptr base::readentry(ReadWriter_ptr r, uint32_t ofs, uint8_t flag)
+// write the sidecar index of hvfile
+void indexhive(const std::string& hvfile, unsigned nthreads)
 {
-    uint32_t size= r->read32le();
-    uint8_t type= size>>28;
-    size &= ~0xf0000000;
-    uint32_t nul_0004= r->read32le();
-    uint32_t id= r->read32le();
-    if (nul_0004 && g_verbose)
-        printf("WARNING: entry +4=%08x\n", nul_0004);
-    ByteVector data;
-    vectorread8(r, data, size);
-
-    if (g_verbose>1)
-        printf("%08x-%08x:[%02x] %06x %x [%08x] ", ofs, ofs+12+size, flag, size, type, id);
-    switch(type) {
-        case ET_DATABASE: return entry_ptr(new database(id, data));
-        case ET_RECORD  : return entry_ptr(new record(id, data));
-        case ET_RECMORE : return entry_ptr(new recordmore(id, data));
-        case ET_VOLUME  : return entry_ptr(new volume(id, data));
-        case ET_ROOTS   : return entry_ptr(new roots(id, data));
-        case ET_KEY     : return entry_ptr(new key(id, data));
-        case ET_VALUE   : return value::readvalue(id, data);
-        case ET_INDEX   : return entry_ptr(new index(id, data));
-        default:
-                     printf("WARNING: unknown entry type %d, id=[%08x], data: %s\n", type, id, vhexdump(data).c_str());
-    }
-    return entry_ptr();
+    mappedfile img(hvfile);
+    HvFile hv(img.data(), img.size());
+    DwordVector entryofs;
+    hv.buildindex(entryofs);
+    hivetable tab(img.data(), hv.maxentries());
+    hv.loadtable(tab, nthreads);
+
+    hiveindexfile::write(hiveindexfile::indexname(hvfile), img.data(), img.size(), entryofs, tab);
+    if (g_verbose)
+        printf("%s: indexed\n", hvfile.c_str());
 }
 
-} // namespace
-
-class HvFile {
-    ReadWriter_ptr _r;
-    DwordVector _offsets;
-    ByteVector _bootmd5;
-
-    struct unkitem {
-        uint32_t type;
-        uint32_t ptr;
-        uint32_t unk;
-        uint32_t flag;
-
-
-        unkitem(uint32_t type, uint32_t ptr, uint32_t unk, uint32_t flag)
-            : type(type), ptr(ptr), unk(unk), flag(flag)
-        {
-        }
-    };
-    template<typename V>
-    static bool is_all_zero(const V& v)
-    {
-        typedef typename V::value_type VALTYPE;
-        return v.end()==std::find_if(v.begin(), v.end(), [](const VALTYPE& x) { return x!=VALTYPE(); });
-    }
-    std::vector<unkitem> _unkitems;
-    void readheader()
-    {
-        _r->setpos(0);
-        uint32_t hdrsize= _r->read32le();       // +0000
-        uint32_t nul_0004= _r->read32le();      // +0004
-        
-        uint32_t magic= _r->read32le();         // +0008
-        if (magic!=0x4d494b45)                  // 'ELIM'
-            throw "not a hv/vol file";
-
-        ByteVector filemd5;
-        vectorread8(_r, filemd5, 16);           // +000c
-
-        uint32_t nul_001c= _r->read32le();      // +001c
-        uint32_t filesize= _r->read32le();      // +0020
-        if (filesize>_r->size()) {
-            printf("WARN: stored filesize > real filesize\n");
-        }
-        if (filesize<_r->size()) {
-            printf("WARN: stored filesize < real filesize\n");
-        }
-        uint32_t filetype= _r->read32le();      // +0024  - 0x1000 for db files
-
-        vectorread8(_r, _bootmd5, 16);           // +0028
-
-        DwordVector usuallynul_0038;
-        vectorread32le(_r, usuallynul_0038, (0xE4-0x38)/4);     // +0038
-        if (!is_all_zero(usuallynul_0038))
-            printf("WARN: +0038: %s\n", vhexdump(usuallynul_0038).c_str());
-
-        uint32_t base= _r->read32le();           // +00e4  .. 0x01025000
-        uint32_t nul_00e8= _r->read32le();      // +00e8  recoverylog size
-        uint32_t isreghive= _r->read32le();     // +00ec
-        uint32_t isdbvol= _r->read32le();       // +00f0
-
-        if (isreghive && filetype!=0)
-            printf("WARNING, unknown flag combination: +0024=%08x, +00ec=%08x\n", filetype, isreghive);
-        if (isdbvol && filetype==0)
-            printf("WARNING, unknown flag combination: +0024=%08x, +00ec=%08x\n", filetype, isdbvol);
-
-        if (hdrsize!=0x400)
-            printf("WARN: unusual hdrsize : %08x\n", hdrsize);
-        if (nul_0004)
-            printf("WARN: +0004: %08x\n", nul_0004);
-        if (nul_001c)
-            printf("WARN: +001c: %08x\n", nul_001c);
-        if (nul_00e8)
-            printf("WARN: +00e8: %08x\n", nul_00e8);
-
-        if (g_verbose) {
-            _r->setpos(0);
-            DwordVector filehdr1;
-            vectorread32le(_r, filehdr1, 0x38/4);
-            DwordVector filehdr2;
-            _r->setpos(0xe4);
-            vectorread32le(_r, filehdr2, (0xf4-0xe4)/4);
-            printf("          hdrsize           magic    --filemd5--------------------------          filesize filetype --bootmd5-------------------------- ... base              isreghv  isdbvol\n");
-            printf("filehdr: %s ...%s\n", vhexdump(filehdr1).c_str(), vhexdump(filehdr2).c_str());
-        }
-
-
-        DwordVector usuallynul_00f4;
-        vectorread32le(_r, usuallynul_00f4, 6); // +00f4
-        if (!is_all_zero(usuallynul_00f4))
-            printf("WARN: +00f4: %s\n", vhexdump(usuallynul_00f4).c_str());
-
-        if (g_verbose) {
-            // read unknown items --- probably ptrs used when mounted
-            printf("base=%08x\n", base);
-            uint32_t ofs= 0x10c;
-            while (ofs<hdrsize) {
-                uint32_t type= _r->read32le();      // +010c + 0x10*i
-                uint32_t ptr= _r->read32le();       // +0110 + 0x10*i
-                uint32_t unk= _r->read32le();       // +0114 + 0x10*i
-                uint32_t flag= _r->read32le();      // +0118 + 0x10*i
-                if (type==0)
-                    break;
-
-                _unkitems.push_back(unkitem(type, ptr, unk, flag));
-
-                printf("%d %08x[+%8x]  %08x %8x\n", type, ptr, ptr-base, unk, flag);
-            }
-        }
-
-
-        // read section ptrs
-        _r->setpos(0x1000);
-
-        _offsets.push_back(_r->read32le());     // +1000
-        while (1)
-        {
-            uint32_t sofs= _r->read32le();      // +1000 + 4*i
-            if (sofs==0)
-                break;
-            _offsets.push_back(sofs);
+// dump the hive in filename to out, returns the nr of queries not found
+unsigned dumphive(const std::string& filename, outputbuffer& out, const dumpoptions& opt)
+{
+    // note: the mapping must outlive the decoded table
+    mappedfile img(filename);
+    HvFile hv(img.data(), img.size());
+
+    std::shared_ptr<hivesource> src;
+    DwordVector entryofs;
+    std::shared_ptr<hiveindexfile> sidecar;
+    if (!opt.keyspec.empty() || !opt.queries.empty()) {
+        // only decode the entries on the path, and in the subtree.
+        // the entry offsets come from the index file, when it is up to date
+        sidecar= hiveindexfile::open(filename, img.data(), img.size(), hv.maxentries());
+        if (sidecar) {
+            src.reset(new lazyhive(img.data(), img.size(), sidecar->entryofs(), sidecar->nentries(), 4096));
         }
-        if (g_verbose)
-            printf("hdrptrs: %s\n", vhexdump(_offsets).c_str());
-        _offsets.push_back(filesize);
-
-        // read section headers
-        for (unsigned i=0 ; i<_offsets.size()-1 ; i++)
-        {
-            _r->setpos(0x5000+_offsets[i]);
-
-            uint32_t smagic= _r->read32le();    // +5000
-            uint32_t snul_0004= _r->read32le(); // +5004
-            uint32_t idx= _r->read32le();       // +5008
-            if (smagic!=0x20001004)
-                throw "invalid section magic";
-            if (snul_0004)
-                printf("WARN: section%d @%08x : +4=%08x\n", i, _offsets[i], snul_0004);
-            if (idx!=i)
-                printf("WARN: section%d @%08x : +8=%08x\n", i, _offsets[i], idx);
+        else {
+            hv.buildindex(entryofs);
+            src.reset(new lazyhive(img.data(), img.size(), entryofs.data(), entryofs.size(), 4096));
         }
     }
-    void writeheader(ReadWriter_ptr w)
-    {
-        w->write32le(0x400);                            // +0000 : filehdr size
-        w->write32le(0);                                // +0004 : 
-        w->write32le(0x4d494b45);                       // +0008 : file magic 'MIKE'
-        // +000c : filemd5 later
-        w->setpos(0x20);
-        w->write32le(w->size());                        // +0020 : filesize
-        w->write32le(0);                                // +0024 : filetype : 0 = hv
-        w->write(&_bootmd5.front(), _bootmd5.size());   // +0028 : bootmd5
-
-        w->setpos(0xe4);
-        w->write32le(0x01025000);                       // +00e4 : base ??
-
-        w->setpos(0xec);
-        w->write32le(-1);                               // +00ec : isreghive
-
-        ByteVector digest(16);
-        calcfilemd5(w, &digest.front());
-        w->setpos(0x0c);
-        w->write(&digest.front(), digest.size());
-    }
-    void calcfilemd5(ReadWriter_ptr w, uint8_t *digest)
+    else {
+        hivetable *tab= new hivetable(img.data(), hv.maxentries());
+        src.reset(tab);
+        hv.loadtable(*tab, opt.nthreads);
+    }
+
+    std::shared_ptr<dumper> d;
+    if (opt.raw)
+        d.reset(new rawdumper(*src, out));
+    else
+        d.reset(new regdumper(*src, out));
+    if (sidecar)
+        d->usesidecar(sidecar.get());
+
+    STATS_PHASE_DETAIL(TRAVERSE, filename);
+    unsigned notfound= 0;
+    if (!opt.queries.empty()) {
+        d->dumproots();
+        for (unsigned q=0 ; q<opt.queries.size() ; q++)
+            if (!d->query(opt.queries[q]))
+                notfound++;
+    }
+    else if (!opt.keyspec.empty())
+        d->dumppath(opt.keyspec);
+    else
+        d->dumproot();
+    return notfound;
+}
+// true when the .reg text in p may have file:PATH values, which read other
+// files. conservative: every "file:" or "file(", in any case, counts.
+bool mayreadfiles(const uint8_t *p, size_t n)
+{
+    std::string text;
+    if (n>=2 && ((p[0]==0xff && p[1]==0xfe) || (p[0]==0xfe && p[1]==0xff)))
+        utf16toutf8(p+2, n-2, p[0]==0xfe, true, text);
+    std::string_view s= text.empty() ? std::string_view((const char*)p, n) : std::string_view(text);
+    for (size_t i= 0 ; i+5<=s.size() ; i++)
+        if (tolower((uint8_t)s[i])=='f' && foldednameequal(s.substr(i, 4), "file") && (s[i+4]==':' || s[i+4]=='('))
+            return true;
+    return false;
+}
+// same as ProcessRegFile, but the parsed events are cached in cachedir,
+// keyed by the md5 of the .reg file. unchanged files are replayed
+// from the cache, without parsing.
+//
+// the key does not cover files read by file:PATH values, so .reg files
+// which may have these are always parsed.
+bool processregfilecached(const std::string& filename, const std::string& cachedir, regkeymaker& mk)
+{
+    std::string cachefile;
     {
-        w->setpos(0xfc);
-        
-        Md5 m;
-        while (!w->eof())
-        {
-            ByteVector data(16384);
-            size_t n= w->read(&data.front(), data.size());
-            m.add(&data.front(), n);
+        mappedfile f(filename);
+        if (mayreadfiles(f.data(), f.size())) {
+            if (g_verbose)
+                printf("%s: has file: values, not cached\n", filename.c_str());
+            return ProcessRegFile(filename, mk);
         }
+        Md5 m;
+        m.add(f.data(), f.size());
+        uint8_t digest[16];
         m.final(digest);
+        cachefile= cachedir+"/"+hexstring(digest, sizeof(digest))+".hvc";
     }
-
-    void writesectionheader(ReadWriter_ptr w, int n)
-    {
-        w->write32le(0x20001004);
-        w->write32le(0);
-        w->write32le(n);
-    }
-public:
-    HvFile()
-        : _rootid(0)
-    {
-        _items.push_back(ent::entry_ptr(new ent::roots(_items.size())));
-        _rootid= _items.back()->id();
-    }
-    HvFile(ReadWriter_ptr r)
-        : _r(r), _rootid(0)
-    {
-        readheader();
-    }
-    void setbootmd5(const ByteVector& md5)
-    {
-        _bootmd5= md5;
-    }
-    void save(ReadWriter_ptr w)
-    {
-        w->setpos(0x5000);
-        std::vector<uint32_t> sectionoffsets;
-        uint64_t sectionendpos;
-        for (unsigned i=0 ; i<_items.size() ; i+=0x400)
+    struct stat st;
+    if (::stat(cachefile.c_str(), &st)==0) {
+        // the whole entry is checked before mk sees any event, a corrupt
+        // entry is removed, and the file parsed again
         {
-            sectionoffsets.push_back(w->getpos()-0x5000);
-            writesectionheader(w, i/0x400);
-            uint64_t offsetblockpos= w->getpos();
-
-            std::vector<uint32_t> itemoffsets;
-
-            // skip item offset block - write later
-            w->setpos(offsetblockpos+0x1000);
-
-            // write item count
-            w->write32le(_items.size()-i<0x400 ? _items.size()-i : 0);
-
-            // write item data
-            for (unsigned j= 0 ; j<0x400 && j+i<_items.size() ; j++)
-            {
-                itemoffsets.push_back(w->getpos()-0x5000);
-
-                _items[i+j]->save(w);
-            }
-            sectionendpos= w->getpos();
-            w->setpos(offsetblockpos);
-            for (unsigned j= 0 ; j<0x400 ; j++)
-                w->write32le(j<itemoffsets.size() ? itemoffsets[j]+1 : j<0x3ff ? (j+1)*0x40000 : 0);
-            w->setpos(sectionendpos);
+            mappedfile cache(cachefile);
+            if (regevents::check(cache.data(), cache.size()))
+                return regevents::replay(cache.data(), cache.size(), mk);
         }
-        if (sectionendpos&0xfff) {
-            size_t padding= 0x1000-(sectionendpos&0xfff);
-            w->truncate(sectionendpos+padding);
+        printf("WARN: %s: invalid cache entry, removed\n", cachefile.c_str());
+        remove(cachefile.c_str());
+    }
+
+    regevents events;
+    if (!ProcessRegFile(filename, events))
+        return false;
+    events.close();
+
+    // write to a temporary file first, so concurrent builds never see a partial cache entry
+    std::string tmpname= stringformat("%s.%08x.tmp", cachefile.c_str(), unsigned(std::random_device()()));
+    FILE *f= fopen(tmpname.c_str(), "wb");
+    if (f) {
+        bool ok= fwrite(events.data().data(), 1, events.data().size(), f)==events.data().size();
+        if (fclose(f)!=0)
+            ok= false;
+        if (!ok || rename(tmpname.c_str(), cachefile.c_str())!=0) {
+            printf("WARN: %s: could not write cache\n", cachefile.c_str());
+            remove(tmpname.c_str());
         }
-        w->setpos(0x1000);
-        for (unsigned j= 0 ; j<sectionoffsets.size() ; j++)
-            w->write32le(sectionoffsets[j]);
-        w->setpos(0);
-        writeheader(w);
     }
-    void enumfileentries(std::function<void(ent::entry_ptr)> cb)
-    {
-        for (unsigned i=0 ; i<_offsets.size()-1 ; i++)
-            enumsectionentries(_offsets[i], _r->size()-0x5000, cb);
+    else {
+        printf("WARN: %s: %s\n", tmpname.c_str(), strerror(errno));
     }
-    void enumsectionentries(uint32_t startofs, uint32_t maxofs, std::function<void(ent::entry_ptr)> cb)
-    {
-        uint32_t ofs= startofs;
-        if (g_verbose>1)
-            printf("%08x-%08x: sectionhdr\n", ofs, ofs+12);
-        DwordVector hdrvalues;
-        _r->setpos(0x5000 + ofs);
-        vectorread32le(_r, hdrvalues, 3);
-        ofs += 12;
-
-        if (g_verbose>1)
-            printf("%08x-%08x: entryptrs\n", ofs, ofs+0x1000);
-        DwordVector iofs;
-        _r->setpos(0x5000 + ofs);
-        vectorread32le(_r, iofs, 0x400);
-        ofs += 0x1000;
-
-        if (g_verbose>1)
-            printf("%08x-%08x: entrycount\n", ofs, ofs+4);
-        // todo:  is this really a count, or something else? it points to the entry with value 0x10000000
-        uint32_t count= _r->read32le();
-        if (g_verbose) {
-            printf("hdr: %s [%08x] %s\n", vhexdump(hdrvalues).c_str(), count, vhexdump(iofs).c_str());
-        }
-
-        ofs += 4;
-
-        for (unsigned i=0 ; i<1024; i++)
-        {
-            uint32_t entryofs= iofs[i]&0x0ffffffc;
-            if ((iofs[i]&3)==1 && entryofs<maxofs) {
-                _r->setpos(0x5000 + entryofs );
-
-                cb(ent::base::readentry(_r, entryofs, (iofs[i]>>28)|((iofs[i]&3)<<4)));
-            }
-            else if (iofs[i]!=(i+1)*0x40000 && iofs[i]!=0) {
-                printf("WARN: @%08x: entry %03x: %08x\n", startofs+12+i*4, i, iofs[i]);
-            }
-        }
+    return regevents::replay(events.data().data(), events.data().size(), mk);
+}
+// build a hive from one or more .reg files, returns false when a .reg file
+// could not be parsed. with cachedir set, parsed files are cached there.
+bool buildhive(const StringList& regfiles, const std::string& outfile, const ByteVector& bootmd5, unsigned nthreads, const std::string& cachedir= "")
+{
+    hvmaker mk;
+    for (unsigned i=0 ; i<regfiles.size() ; i++) {
+        if (!cachedir.empty() ? !processregfilecached(regfiles[i], cachedir, mk) : !ProcessRegFile(regfiles[i], mk))
+            return false;
     }
 
+    if (!bootmd5.empty())
+        mk.setbootmd5(bootmd5);
+    mk.save(ReadWriter_ptr(new FileReader(outfile, FileReader::createnew)), nthreads);
+    return true;
+}
 
-    typedef std::map<std::string, uint32_t> pathmap_t;
-    typedef std::map<HKEY,pathmap_t> rootmap_t;
-    uint32_t _rootid;
-    std::vector<ent::entry_ptr> _items;
-    rootmap_t _roots;
+// size, mtime and md5 of a batch input, the md5 is only calculated
+// when size and mtime are not enough to decide the input is unchanged.
+struct inputstate {
+    uint64_t size;
+    int64_t mtime;
+    std::string md5;
 
-    uint32_t allocpath(HKEY root, uint32_t parent, const std::string& path)
+    inputstate() : size(0), mtime(0) { }
+    bool stat(const std::string& filename)
     {
-        _items.push_back(ent::entry_ptr(new ent::key(_items.size(), path)));
-        uint32_t id= _items.back()->id();
-
-        if (parent) {
-            uint32_t lkey= _items[parent]->askey()->lastchild();
-            if (!lkey)
-                _items[parent]->askey()->firstchild(id);
-            else
-                _items[lkey]->askey()->nextsibling(id);
-            _items[parent]->askey()->lastchild(id);
-        }
-        else {
-            uint32_t rkey= _items[_rootid]->asroots()->lasthivekey(root);
-            if (!rkey)
-                _items[_rootid]->asroots()->hiveid(root, id);
-            else 
-                _items[rkey]->askey()->nextsibling(id);
-            _items[_rootid]->asroots()->lasthivekey(root, id);
-        }
-
-        return id;
+        struct stat st;
+        if (::stat(filename.c_str(), &st)==-1)
+            return false;
+        size= st.st_size;
+        mtime= st.st_mtime;
+        return true;
     }
-    void dumpmap(const pathmap_t& m)
+    void calcmd5(const std::string& filename)
     {
-        printf("M: ");
-        for (auto i= m.begin() ; i!=m.end() ; ++i)
-            printf(" %08x:'%s'", i->second, i->first.c_str());
-        printf("\n");
+        mappedfile f(filename);
+        Md5 m;
+        m.add(f.data(), f.size());
+        uint8_t digest[16];
+        m.final(digest);
+        md5= hexstring(digest, sizeof(digest));
     }
-    uint32_t createpath(HKEY root, pathmap_t& pmap, const std::string& path)
-    {
-        auto p= pmap.find(path);
-        if (p!=pmap.end())
-            return p->second;
-
-        size_t slash= path.find_last_of("\\");
-        uint32_t parentid= slash==path.npos ? 0 : createpath(root, pmap, path.substr(0,slash));
-
-        uint32_t id= allocpath(root, parentid, slash==path.npos ? path : path.substr(slash+1));
+};
 
-        auto ins= pmap.insert(pathmap_t::value_type(path, id));
-        if (!ins.second)
-            throw "insert failed unexpectedly";
-        return ins.first->second;
-    }
-    uint32_t CreateKey(const RegistryPath& regpath)
+// the state of the inputs of a previous batch run, stored in the output
+// directory, one line per input: size mtime md5 filename.
+// the first line holds the options, when those changed, all inputs are converted again.
+class batchmanifest {
+    std::string _filename;
+    std::string _options;
+    std::map<std::string,inputstate> _inputs;
+    std::mutex _mtx;
+public:
+    batchmanifest(const std::string& filename, const std::string& options)
+        : _filename(filename), _options(options)
     {
-        // lookup path in cache or alloc new path, then return id
-        auto r= _roots.find(regpath.GetRoot());
-        if (r==_roots.end())
-        {
-            auto ins= _roots.insert(rootmap_t::value_type(regpath.GetRoot(), pathmap_t()));
-            if (!ins.second)
-                throw "insert failed unexpectedly";
-            r= ins.first;
-        }
-        pathmap_t &root= r->second;
-        return createpath(regpath.GetRoot(), root, regpath.GetPath());
     }
-    void SetValue(uint32_t keyid, const std::string& valuename, const RegistryValue& value)
+    void load()
     {
-        ent::value_ptr v;
-        switch(value.GetType())
+        FILE *f= fopen(_filename.c_str(), "r");
+        if (f==NULL)
+            return;
+        char buf[65536];
+        bool sameoptions= false;
+        if (fgets(buf, sizeof(buf), f))
+            sameoptions= std::string(buf)==_options+"\n";
+        while (sameoptions && fgets(buf, sizeof(buf), f)) {
+            inputstate st;
+            char md5[33];
+            int n= 0;
+            if (sscanf(buf, "%" SCNu64 " %" SCNd64 " %32s %n", &st.size, &st.mtime, md5, &n)<3 || n==0)
+                continue;
+            std::string name= buf+n;
+            while (!name.empty() && (name[name.size()-1]=='\n' || name[name.size()-1]=='\r'))
+                name.resize(name.size()-1);
+            st.md5= md5;
+            _inputs[name]= st;
+        }
+        fclose(f);
+    }
+    void save()
+    {
+        std::string tmpname= _filename+".tmp";
+        FILE *f= fopen(tmpname.c_str(), "w");
+        if (f==NULL)
+            throw stringformat("%s: %s", tmpname.c_str(), strerror(errno));
+        fprintf(f, "%s\n", _options.c_str());
+        for (auto& i : _inputs)
+            fprintf(f, "%" PRIu64 " %" PRId64 " %s %s\n", i.second.size, i.second.mtime, i.second.md5.c_str(), i.first.c_str());
+        bool ok= ferror(f)==0;
+        if (fclose(f)!=0)
+            ok= false;
+        if (!ok || rename(tmpname.c_str(), _filename.c_str())!=0)
+            throw stringformat("%s: %s", _filename.c_str(), strerror(errno));
+    }
+    // true when filename has the same contents as in the previous run.
+    // when the mtime changed, but the size did not, the md5 decides.
+    bool unchanged(const std::string& filename, inputstate& st)
+    {
+        inputstate prev;
         {
-            case REG_SZ:       v= ent::value_ptr(new ent::stringvalue(_items.size(), valuename, value.GetString())); break;
-            case REG_BINARY:   v= ent::value_ptr(new ent::binaryvalue(_items.size(), valuename, value.GetData())); break;
-            case REG_DWORD:    v= ent::value_ptr(new ent::dwordvalue(_items.size(), valuename, value.GetDword())); break;
-            case REG_MULTI_SZ: v= ent::value_ptr(new ent::stringlistvalue(_items.size(), valuename, value.GetStringList())); break;
-            case REG_MUI_SZ:   v= ent::value_ptr(new ent::muistringvalue(_items.size(), valuename, value.GetString())); break;
+            std::lock_guard<std::mutex> lock(_mtx);
+            auto i= _inputs.find(filename);
+            if (i==_inputs.end())
+                return false;
+            prev= i->second;
         }
-        if (!v) {
-            printf("WARN: unsupported: %s\n", value.AsString(0).c_str());
-            throw "unsupported registryvalue type";
+        if (prev.size!=st.size)
+            return false;
+        if (prev.mtime==st.mtime) {
+            st.md5= prev.md5;
+            return true;
         }
-
-        _items.push_back(v);
-
-        uint32_t lastv= _items[keyid]->askey()->lastvalue();
-        if (lastv==0)
-            _items[keyid]->askey()->firstvalue(v->id());
-        else
-            _items[lastv]->asvalue()->nextvalue(v->id());
-        _items[keyid]->askey()->lastvalue(v->id());
-
+        st.calcmd5(filename);
+        return st.md5==prev.md5;
     }
-};
-struct hvmaker : regkeymaker {
-    HvFile hv;
-    uint32_t curkey;
-    hvmaker()
-        : curkey(0)
-    {
-    }
-    void newkey(const RegistryPath& path)
-    {
-        curkey= hv.CreateKey(path);
-    }
-    void setval(const std::string& valuename, const RegistryValue& value)
-    {
-        hv.SetValue(curkey, valuename=="@" ? "Default" : valuename, value);
-    }
-
-    void setbootmd5(const ByteVector& md5)
+    void update(const std::string& filename, const inputstate& st)
     {
-        hv.setbootmd5(md5);
+        std::lock_guard<std::mutex> lock(_mtx);
+        _inputs[filename]= st;
     }
-    void save(ReadWriter_ptr w)
+    void remove(const std::string& filename)
     {
-        hv.save(w);
+        std::lock_guard<std::mutex> lock(_mtx);
+        _inputs.erase(filename);
     }
-}; 
+};
 
-class dumper {
-    const ent::entrymap_t& items;
-public:
-    dumper(const ent::entrymap_t& items) : items(items) { }
-    virtual ~dumper() { }
+bool endswith(const std::string& str, const std::string& suffix)
+{
+    return str.size()>=suffix.size() && str.compare(str.size()-suffix.size(), suffix.size(), suffix)==0;
+}
+// OUTDIR/NAME.hv for NAME.reg, and OUTDIR/NAME.reg for NAME.hv
+std::string batchoutputname(const std::string& outdir, const std::string& input, bool& isreg)
+{
+    size_t slash= input.find_last_of("/\\");
+    std::string name= slash==input.npos ? input : input.substr(slash+1);
+    size_t dot= name.rfind('.');
+    std::string ext= dot==name.npos ? "" : name.substr(dot);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    isreg= ext==".reg";
+    if (dot!=name.npos)
+        name.resize(dot);
+    return outdir+"/"+name+(isreg ? ".hv" : ".reg");
+}
 
-    void dumpvalues(uint32_t id)
-    {
-        while (id)
-        {
-            ent::value *v= getval(id);
-            dumpvalue(v);
-            id= v->nextvalue();
-        }
-    }
-    virtual void dumpvalue(ent::value *v)= 0;
-    void dumpkeys(uint32_t id, const std::string& path)
-    {
-        while (id)
-        {
-            ent::key *k= getkey(id);
-            dumpkey(k, path);
-            dumpvalues(k->firstvalue());
-            dumpkeys(k->firstchild(), path+"\\"+k->name());
-            id= k->nextsibling();
-        }
-    }
-    virtual void dumpkey(ent::key *k, const std::string& path)= 0;
-    void dumproot()            
-    {
-        ent::roots *r= getroot(0);
-        if (!r) {
-            printf("could not find root\n");
+// convert each input to its own output in outdir, on nthreads worker threads.
+// a failing input is reported, and does not stop the other conversions.
+// returns the nr of failed inputs.
+unsigned runbatch(const StringList& files, const std::string& outdir, const dumpoptions& opt, const ByteVector& bootmd5, unsigned nthreads)
+{
+    std::string options= stringformat("; hvtool batch%s -k '%s' -b %s", opt.raw ? " -r" : "", opt.keyspec.c_str(), hexstring(bootmd5.data(), bootmd5.size()).c_str());
+    for (auto& q : opt.queries)
+        options += " -q '"+q+"'";
+    // inputs with the same name in different directories would be written
+    // to the same output, by several threads. compared case insensitive,
+    // for windows and macos file systems
+    std::map<std::string,std::string> outputs;
+    for (auto& input : files) {
+        bool isreg;
+        std::string output= batchoutputname(outdir, input, isreg);
+        std::transform(output.begin(), output.end(), output.begin(), ::tolower);
+        auto i= outputs.emplace(output, input);
+        if (!i.second)
+            throw stringformat("%s and %s have the same output %s", i.first->second.c_str(), input.c_str(), batchoutputname(outdir, input, isreg).c_str());
+    }
+
+    batchmanifest manifest(outdir+"/hvtool.manifest", options);
+    manifest.load();
+
+    // the inputs are spread over the threads, each input is converted by one thread
+    dumpoptions fileopt= opt;
+    fileopt.nthreads= 1;
+
+    std::atomic<unsigned> next(0);
+    std::atomic<unsigned> nconverted(0), nunchanged(0), nfailed(0);
+
+    auto convert= [&](const std::string& input) {
+        bool isreg;
+        std::string output= batchoutputname(outdir, input, isreg);
+
+        inputstate st;
+        if (!st.stat(input))
+            throw stringformat("%s", strerror(errno));
+        struct stat ost;
+        if (::stat(output.c_str(), &ost)==0 && manifest.unchanged(input, st)) {
+            nunchanged++;
             return;
         }
-        dumproots(r);
+        manifest.remove(input);
 
-        dumpkeys(r->hiveid((HKEY)ent::HKCR), "HKCR");
-        dumpkeys(r->hiveid((HKEY)ent::HKCU), "HKCU");
-        dumpkeys(r->hiveid((HKEY)ent::HKLM), "HKLM");
-    }
-    virtual void dumproots(ent::roots *r)= 0;
-    ent::entry_ptr get(uint32_t id)
-    {
-        auto i= items.find(id&0x0fffffff);
-        if (i==items.end())
-            return ent::entry_ptr();
-
-        return i->second;
-    }
-    ent::roots* getroot(uint32_t id)
-    {
-        auto p= get(id);
-        if (p)
-            return p->asroots();
-
-        return NULL;
-    }
-    ent::key* getkey(uint32_t id)
-    {
-        auto p= get(id);
-        if (p)
-            return p->askey();
+        if (isreg) {
+            if (!buildhive(StringList(1, input), output, bootmd5, 1))
+                throw "parse error";
+        }
+        else {
+            outputbuffer out(output);
+            dumphive(input, out, fileopt);
+            out.flush();
+        }
+        if (st.md5.empty())
+            st.calcmd5(input);
+        manifest.update(input, st);
+        nconverted++;
+    };
 
-        return NULL;
-    }
-    ent::value* getval(uint32_t id)
-    {
-        auto p= get(id);
-        if (p)
-            return p->asvalue();
+    std::vector<std::thread> workers;
+    for (unsigned t=0 ; t<std::max(nthreads, 1U) && t<files.size() ; t++)
+        workers.push_back(std::thread([&]() {
+            while (true) {
+                unsigned i= next++;
+                if (i>=files.size())
+                    break;
+                try {
+                    convert(files[i]);
+                    continue;
+                }
+                catch(const char*msg) { printf("ERROR: %s: %s\n", files[i].c_str(), msg); }
+                catch(const std::string& msg) { printf("ERROR: %s: %s\n", files[i].c_str(), msg.c_str()); }
+                catch(const std::exception& e) { printf("ERROR: %s: %s\n", files[i].c_str(), e.what()); }
+                catch(...) { printf("ERROR: %s: unknown error\n", files[i].c_str()); }
+                nfailed++;
+            }
+        }));
+    for (auto& w : workers)
+        w.join();
 
-        return NULL;
-    }
-};
-class rawdumper : public dumper {
-public:
-    rawdumper(const ent::entrymap_t& items) : dumper(items) { }
-    virtual void dumpvalue(ent::value *v)
-    {
-        printf("[%08x]         n:%08x %-64s  %s\n", v->id(), v->nextvalue(), v->name().c_str(), v->asstring().c_str());
-    }
-    virtual void dumpkey(ent::key *k, const std::string& path)
-    {
-        printf("[%08x] KEY S:%08x C:%08x V:%08x %s\n", k->id(), k->nextsibling(), k->firstchild(), k->firstvalue(), k->name().c_str());
-    }
-    virtual void dumproots(ent::roots* r)
-    {
-        printf("[%08d]   hkcr:[%08x], hkcu:[%08x], hklm:[%08x]\n", r->id(), r->hiveid((HKEY)ent::HKCR), r->hiveid((HKEY)ent::HKCU), r->hiveid((HKEY)ent::HKLM));
-    }
+    manifest.save();
+    printf("batch: %u converted, %u unchanged, %u failed\n", unsigned(nconverted), unsigned(nunchanged), unsigned(nfailed));
+    return nfailed;
+}
+#ifdef WITH_STATS
 
-};
-class regdumper : public dumper {
-public:
-    regdumper(const ent::entrymap_t& items) : dumper(items) { }
+// peak resident set size, in kbytes
+uint64_t peakrss()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!K32GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return 0;
+    return pmc.PeakWorkingSetSize/1024;
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru)==-1)
+        return 0;
+#ifdef __APPLE__
+    return ru.ru_maxrss/1024;
+#else
+    return ru.ru_maxrss;
+#endif
+#endif
+}
 
-    virtual void dumpvalue(ent::value *v)
-    {
-        if (v->name() == "Default")
-            printf(" @=%s\n", v->asstring().c_str());
+// print the --stats report to stderr, or as json to jsonfile
+void printstats(const std::string& jsonfile, double totalseconds)
+{
+    static const char *typenames[16]= { 0, 0, 0, 0, 0, 0, 0, "database", "record", "recordmore", "volume", "roots", "key", "value", "index", 0 };
+    auto typename_= [](int t) { return typenames[t] ? std::string(typenames[t]) : stringformat("type%d", t); };
+    auto& ph= phasestats::phases;
+    if (jsonfile.empty()) {
+        fprintf(stderr, "%-12s %10s %10s %10s %14s\n", "phase", "calls", "wall ms", "cpu ms", "bytes");
+        for (int p=0 ; p<phasestats::NPHASES ; p++)
+            if (ph[p].calls)
+                fprintf(stderr, "%-12s %10" PRIu64 " %10.3f %10.3f %14" PRIu64 "\n", phasestats::name(p),
+                        uint64_t(ph[p].calls), ph[p].wallns/1e6, ph[p].cpuns/1e6, uint64_t(ph[p].bytes));
+        const char *sep= "entries:";
+        for (int t=0 ; t<16 ; t++)
+            if (phasestats::entries[t]) {
+                fprintf(stderr, "%s %s %" PRIu64, sep, typename_(t).c_str(), uint64_t(phasestats::entries[t]));
+                sep= ",";
+            }
+        if (*sep==',')
+            fprintf(stderr, "\n");
+        fprintf(stderr, "total %.3f ms, %" PRIu64 " allocations, peak rss %" PRIu64 " kB\n", totalseconds*1e3, uint64_t(allocstats::count), peakrss());
+        return;
+    }
+    FILE *f= fopen(jsonfile.c_str(), "w");
+    if (f==NULL) {
+        fprintf(stderr, "%s: %s\n", jsonfile.c_str(), strerror(errno));
+        return;
+    }
+    fprintf(f, "{\n  \"phases\": [\n");
+    const char *sep= "";
+    for (int p=0 ; p<phasestats::NPHASES ; p++) {
+        if (!ph[p].calls)
+            continue;
+        fprintf(f, "%s    { \"name\": \"%s\", \"calls\": %" PRIu64 ", \"wall_ms\": %.3f, \"cpu_ms\": %.3f, \"bytes\": %" PRIu64 " }",
+                sep, phasestats::name(p), uint64_t(ph[p].calls), ph[p].wallns/1e6, ph[p].cpuns/1e6, uint64_t(ph[p].bytes));
+        sep= ",\n";
+    }
+    fprintf(f, "\n  ],\n  \"entries\": {");
+    sep= "";
+    for (int t=0 ; t<16 ; t++) {
+        if (!phasestats::entries[t])
+            continue;
+        fprintf(f, "%s \"%s\": %" PRIu64, sep, typename_(t).c_str(), uint64_t(phasestats::entries[t]));
+        sep= ",";
+    }
+    fprintf(f, " },\n");
+    fprintf(f, "  \"total_ms\": %.3f,\n", totalseconds*1e3);
+    fprintf(f, "  \"allocations\": %" PRIu64 ",\n", uint64_t(allocstats::count));
+    fprintf(f, "  \"peak_rss_kb\": %" PRIu64 "\n", peakrss());
+    fprintf(f, "}\n");
+    fclose(f);
+}
+std::string jsonescape(const std::string& str)
+{
+    std::string esc;
+    for (char c : str) {
+        if (c=='"' || c=='\\')
+            esc += '\\';
+        if (uint8_t(c)<0x20)
+            esc += stringformat("\\u%04x", c);
         else
-            printf(" \"%s\"=%s\n", v->name().c_str(), v->asstring().c_str());
+            esc += c;
     }
-    virtual void dumpkey(ent::key *k, const std::string& path)
-    {
-        if (k->firstvalue() || !k->firstchild())
-            printf("\n[%s\\%s]\n", path.c_str(), k->name().c_str());
+    return esc;
+}
+// write the --trace spans in the chrome trace event format, viewable
+// in chrome://tracing or ui.perfetto.dev
+void writetrace(const std::string& tracefile)
+{
+    FILE *f= fopen(tracefile.c_str(), "w");
+    if (f==NULL) {
+        fprintf(stderr, "%s: %s\n", tracefile.c_str(), strerror(errno));
+        return;
+    }
+    std::lock_guard<std::mutex> lock(phasestats::tracemtx);
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    const char *sep= "";
+    for (auto& buf : phasestats::tracebuffers) {
+        fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"thread %d\"}}", sep, buf->tid, buf->tid);
+        sep= ",\n";
+        for (auto& e : buf->events) {
+            fprintf(f, ",\n{\"name\": \"%s\", \"cat\": \"hvtool\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+                    phasestats::name(e.phase), buf->tid, e.start/1e3, (e.end-e.start)/1e3);
+            if (!e.detail.empty())
+                fprintf(f, ", \"args\": {\"detail\": \"%s\"}", jsonescape(e.detail).c_str());
+            fprintf(f, "}");
+        }
     }
-    virtual void dumproots(ent::roots* r)
-    {
-        printf("REGEDIT4\n");
+    fprintf(f, "\n]}\n");
+    fclose(f);
+}
+// prints the --stats report, and writes the --trace file when main returns
+struct statsreport {
+    std::string jsonfile;
+    std::string tracefile;
+    uint64_t start;
+    statsreport() : start(phasestats::wallclock()) { }
+    ~statsreport()
+    {
+        if (phasestats::enabled)
+            printstats(jsonfile, (phasestats::wallclock()-start)/1e9);
+        if (phasestats::tracing)
+            writetrace(tracefile);
     }
 };
+#endif
+
 void usage()
 {
-    printf("Usage: hvtool [-v] [-r] [-o OUTFILE] [-b bootmd5hex]  regfiles...\n");
+    printf("Usage: hvtool [-v] [-r] [-o OUTFILE] [-j N] [-C CACHEDIR] [-b bootmd5hex]  regfiles...\n");
+    printf("       hvtool [-v] [-r] [-O DUMPFILE] [-j N] [-k KEYPATH]  hvfiles...\n");
+    printf("       hvtool [-v] [-r] [-O DUMPFILE] [-q QUERY] [-Q QUERYFILE]  hvfiles...\n");
+    printf("       hvtool [-v] [-r] [-B OUTDIR] [-j N] [-b bootmd5hex]  hvfiles-or-regfiles...\n");
+    printf("       hvtool [-O DUMPFILE] [-j N] --diff|--diff-reg  a.hv b.hv\n");
+    printf("       hvtool --index  HVFILES\n");
+    printf("       hvtool --patch HVFILE  regfiles...\n");
+    printf("       hvtool --set KEYPATH:VALUENAME=VALUESPEC ...  hvfiles...\n");
+    printf("   -C CACHEDIR  cache the parsed regfiles in CACHEDIR, unchanged files are not parsed again\n");
+    printf("   -O DUMPFILE  write the dump to DUMPFILE instead of stdout\n");
+    printf("   -B OUTDIR    batch mode: convert each NAME.hv to OUTDIR/NAME.reg, and each NAME.reg to\n");
+    printf("                OUTDIR/NAME.hv, using -j N threads. inputs unchanged since the previous run,\n");
+    printf("                according to OUTDIR/hvtool.manifest, are skipped\n");
+    printf("   -k KEYPATH   only dump the subtree at KEYPATH, decoding only the entries needed\n");
+    printf("   -j N         decode or encode sections using N threads, 0 = one per cpu\n");
+    printf("   -q QUERY     print KEYPATH or KEYPATH:VALUENAME, can be repeated\n");
+    printf("   -Q FILE      read queries from FILE, one per line\n");
+    printf("   --diff       list the keys and values added (+), removed (-) and changed in b.hv\n");
+    printf("   --diff-reg   write the differences as a .reg file, which changes a.hv into b.hv\n");
+    printf("   --index      write HVFILE.idx, used by -k and -q for direct key lookups\n");
+    printf("   --patch HVFILE  apply the regfiles to HVFILE in place, appending new entries\n");
+    printf("   -T, --stats  print the time, calls and bytes of each phase to stderr\n");
+    printf("   --stats=FILE write the phase statistics as json to FILE\n");
+    printf("   --trace FILE write a timeline of the phases of each thread to FILE, in chrome trace format\n");
+    printf("   --set SET    overwrite an existing value in place, with a value of the same size, can be repeated\n");
 }
 int main(int argc, char**argv)
 {
     StringList files;
     std::string outfile;
+    std::string dumpfile;
     std::string bootmd5arg;
     ByteVector bootmd5;
-    bool fDumpAsRaw= false;
-
+    std::string batchdir;
+    std::string patchfile;
+    std::string cachedir;
+    StringList sets;
+    enum { NODIFF, DIFFLIST, DIFFREG } diffmode= NODIFF;
+    bool makeindex= false;
+    bool stats= false;
+    std::string statsfile;
+    std::string tracefile;
+    dumpoptions opt;
+    unsigned nthreads= 1;
+    std::string queryfile;
+    unsigned notfound= 0;
+#ifdef WITH_STATS
+    statsreport report;
+#endif
 
     try {
     for (int i=1 ; i<argc ; i++)
     {
-        if (argv[i][0]=='-') switch(argv[i][1])
+        if (strcmp(argv[i], "--diff")==0)
+            diffmode= DIFFLIST;
+        else if (strcmp(argv[i], "--diff-reg")==0)
+            diffmode= DIFFREG;
+        else if (strcmp(argv[i], "--index")==0)
+            makeindex= true;
+        else if (strcmp(argv[i], "--stats")==0)
+            stats= true;
+        else if (strcmp(argv[i], "--trace")==0) {
+            if (i+1>=argc)
+                throw "expected argument";
+            tracefile= argv[++i];
+        }
+        else if (strncmp(argv[i], "--stats=", 8)==0) {
+            stats= true;
+            statsfile= argv[i]+8;
+        }
+        else if (strcmp(argv[i], "--set")==0) {
+            if (i+1>=argc)
+                throw "expected argument";
+            sets.push_back(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--patch")==0) {
+            if (i+1>=argc)
+                throw "expected argument";
+            patchfile= argv[++i];
+        }
+        else if (argv[i][0]=='-') switch(argv[i][1])
         {
             case 'o': getarg(argv, i, argc, outfile); break;
+            case 'O': getarg(argv, i, argc, dumpfile); break;
+            case 'B': getarg(argv, i, argc, batchdir); break;
+            case 'C': getarg(argv, i, argc, cachedir); break;
             case 'b': bootmd5arg = getstrarg(argv, i, argc); break;
             case 'v': g_verbose+=countoptionmultiplicity(argv, i, argc); break;
-            case 'r': fDumpAsRaw= true;; break;
+            case 'r': opt.raw= true;; break;
+            case 'k': getarg(argv, i, argc, opt.keyspec); break;
+            case 'q': opt.queries.push_back(getstrarg(argv, i, argc)); break;
+            case 'Q': getarg(argv, i, argc, queryfile); break;
+            case 'T': stats= true; break;
+            case 'j': nthreads= strtoul(getstrarg(argv, i, argc), 0, 0);
+                      if (nthreads==0)
+                          nthreads= std::thread::hardware_concurrency();
+                      break;
             default:
                       usage();
                       return 1;
@@ -1158,43 +1421,80 @@ int main(int argc, char**argv)
             files.push_back(argv[i]);
         }
     }
+    if (stats) {
+#ifdef WITH_STATS
+        phasestats::enabled= true;
+        allocstats::enabled= true;
+        report.jsonfile= statsfile;
+#else
+        printf("WARNING: built without OPT_STATS, --stats is ignored\n");
+#endif
+    }
+    if (!tracefile.empty()) {
+#ifdef WITH_STATS
+        phasestats::starttrace();
+        report.tracefile= tracefile;
+#else
+        printf("WARNING: built without OPT_STATS, --trace is ignored\n");
+#endif
+    }
     if (!bootmd5arg.empty())
         hex2binary(bootmd5arg, bootmd5);
+    if (!queryfile.empty() && !readqueries(queryfile, opt.queries))
+        return 1;
+    opt.nthreads= nthreads;
 
     if (files.empty()) {
         usage();
         return 1;
     }
-    if (!outfile.empty()) {
-        hvmaker mk;
-        for (unsigned i=0 ; i<files.size() ; i++) {
-            if (!ProcessRegFile(files[i], mk))
-                return 1;
+    if (!sets.empty()) {
+        for (unsigned i=0 ; i<files.size() ; i++)
+            setvalues(files[i], sets);
+    }
+    else if (makeindex) {
+        for (unsigned i=0 ; i<files.size() ; i++)
+            indexhive(files[i], nthreads);
+    }
+    else if (!patchfile.empty()) {
+        if (!patchhive(patchfile, files))
+            return 1;
+    }
+    else if (diffmode!=NODIFF) {
+        if (files.size()!=2) {
+            usage();
+            return 1;
         }
-
-        if (!bootmd5.empty())
-            mk.setbootmd5(bootmd5);
-        mk.save(ReadWriter_ptr(new FileReader(outfile, FileReader::createnew)));
+        outputbuffer out(dumpfile);
+        unsigned ndiffs= diffhives(files[0], files[1], out, diffmode==DIFFREG, nthreads);
+        out.flush();
+        // as diff: exit code 1 when the hives differ
+        if (ndiffs)
+            return 1;
+    }
+    else if (!batchdir.empty()) {
+        if (runbatch(files, batchdir, opt, bootmd5, nthreads))
+            return 1;
+    }
+    else if (!outfile.empty()) {
+        if (!buildhive(files, outfile, bootmd5, nthreads, cachedir))
+            return 1;
     }
     else {
+        outputbuffer out(dumpfile);
         for (unsigned i=0 ; i<files.size() ; i++) {
             if (files.size()>1)
-            printf(";=============== processing %s\n", files[i].c_str());
-
-            ent::entrymap_t items;
-            HvFile hv(ReadWriter_ptr(new MmapReader(files[i], MmapReader::readonly)));
-
-            hv.enumfileentries([&items](ent::entry_ptr p) {
-                items.insert(ent::entrymap_t::value_type(p->id(), p));
-            });
-            std::shared_ptr<dumper> d;
-            if (fDumpAsRaw)
-                d.reset(new rawdumper(items));
-            else
-                d.reset(new regdumper(items));
-            d->dumproot();
+            out.format(";=============== processing %s\n", files[i].c_str());
+
+            // decoder warnings are printed directly to stdout
+            out.flush();
+
+            notfound += dumphive(files[i], out, opt);
         }
+        out.flush();
     }
+    if (notfound)
+        return 1;
     }
     catch(const char*msg) { printf("ERROR: %s\n", msg); return 1; }
     catch(const std::string& msg) { printf("ERROR: %s\n", msg.c_str()); return 1; }
@@ -0,0 +1,154 @@
+#ifndef _REGGEN_H_
+#define _REGGEN_H_
+// deterministic generator of registry trees with a given shape.
+// the keys and values are passed to a regkeymaker, the same shape and seed
+// always produce the same tree, on every platform.
+#include <stdint.h>
+#include <string>
+#include <regfileparser.h>
+
+struct hiveshape {
+    unsigned depth= 4;          // levels of subkeys below each top level key
+    unsigned fanout= 4;         // subkeys per key
+    unsigned values= 4;         // values per key
+    unsigned topkeys= 2;        // top level keys, alternating between HKCU and HKLM
+    uint64_t seed= 1;
+
+    // relative weights of the value types
+    enum { SZ, DWORD, BINARY, MULTI_SZ, MUI_SZ, NTYPES };
+    unsigned typeweights[NTYPES]= { 4, 2, 2, 1, 0 };
+
+    // key and value name lengths, and string and binary payload lengths
+    unsigned minnamelen= 4, maxnamelen= 12;
+    unsigned minpayload= 4, maxpayload= 48;
+
+    // stop after this many keys and values, or when the estimated size of
+    // the encoded hive reaches maxsize. 0 = no limit
+    uint64_t maxentries= 0;
+    uint64_t maxsize= 0;
+
+    // the nr of keys in the full tree
+    uint64_t nkeys() const
+    {
+        uint64_t n= 1, level= 1;
+        for (unsigned i=0 ; i<depth ; i++) {
+            level *= fanout;
+            n += level;
+        }
+        return n*topkeys;
+    }
+};
+
+class reggenerator {
+    hiveshape _shape;
+    uint64_t _rng;
+    uint64_t _nentries;
+    uint64_t _size;
+
+    // splitmix64, the std distributions differ between platforms
+    uint64_t next()
+    {
+        uint64_t z= (_rng += 0x9e3779b97f4a7c15ULL);
+        z= (z ^ (z>>30)) * 0xbf58476d1ce4e5b9ULL;
+        z= (z ^ (z>>27)) * 0x94d049bb133111ebULL;
+        return z ^ (z>>31);
+    }
+    unsigned random(unsigned n) { return n ? next()%n : 0; }
+    unsigned random(unsigned lo, unsigned hi) { return hi>lo ? lo+random(hi-lo+1) : lo; }
+
+    std::string randomtext(unsigned len)
+    {
+        static const char chars[]= "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 ";
+        std::string s(len, ' ');
+        for (auto& c : s)
+            c= chars[random(sizeof(chars)-1)];
+        return s;
+    }
+    // names are unique between siblings: a random prefix and the index
+    std::string makename(const char *prefix, unsigned i)
+    {
+        std::string suffix= std::to_string(i);
+        unsigned len= random(_shape.minnamelen, _shape.maxnamelen);
+        std::string name= prefix;
+        while (name.size()+suffix.size()<len)
+            name += 'a'+random(26);
+        return name+suffix;
+    }
+
+    bool full() const
+    {
+        return (_shape.maxentries && _nentries>=_shape.maxentries)
+            || (_shape.maxsize && _size>=_shape.maxsize);
+    }
+    // the encoded size of an entry, see ent::key::save and ent::value::save
+    void addentry(size_t namelen, size_t payload)
+    {
+        _nentries++;
+        _size += (28+2*namelen+payload+3)&~3;
+    }
+
+    RegistryValue makevalue()
+    {
+        unsigned total= 0;
+        for (auto w : _shape.typeweights)
+            total += w;
+        unsigned r= random(total);
+        unsigned type= 0;
+        while (type+1<hiveshape::NTYPES && r>=_shape.typeweights[type])
+            r -= _shape.typeweights[type++];
+
+        switch(type) {
+            case hiveshape::DWORD:
+                return RegistryValue(uint32_t(next()));
+            case hiveshape::BINARY: {
+                ByteVector data(random(_shape.minpayload, _shape.maxpayload));
+                for (auto& b : data)
+                    b= random(256);
+                return RegistryValue(data);
+            }
+            case hiveshape::MULTI_SZ: {
+                StringList list;
+                unsigned n= 1+random(3);
+                for (unsigned i=0 ; i<n ; i++)
+                    list.push_back(randomtext(1+random(_shape.minpayload, _shape.maxpayload)/n));
+                return RegistryValue(list);
+            }
+            case hiveshape::MUI_SZ:
+                return RegistryValue(REG_MUI_SZ, randomtext(random(_shape.minpayload, _shape.maxpayload)));
+            default:
+                return RegistryValue(REG_SZ, randomtext(random(_shape.minpayload, _shape.maxpayload)));
+        }
+    }
+
+    void generatekey(regkeymaker& mk, const RegistryPath& path, unsigned level)
+    {
+        mk.newkey(path);
+        addentry(path.GetPath().size()-path.GetPath().rfind('\\')-1, 0);
+        for (unsigned i=0 ; i<_shape.values && !full() ; i++) {
+            std::string name= makename("Val", i);
+            RegistryValue value= makevalue();
+            mk.setval(name, value);
+            addentry(name.size(), value.GetData().size());
+        }
+        if (level==_shape.depth)
+            return;
+        for (unsigned i=0 ; i<_shape.fanout && !full() ; i++)
+            generatekey(mk, RegistryPath(path, makename("Key", i)), level+1);
+    }
+public:
+    reggenerator(const hiveshape& shape)
+        : _shape(shape), _rng(shape.seed), _nentries(0), _size(0)
+    {
+    }
+
+    void generate(regkeymaker& mk)
+    {
+        for (unsigned i=0 ; i<_shape.topkeys && !full() ; i++)
+            generatekey(mk, RegistryPath(RegistryPath(i%2 ? HKEY_LOCAL_MACHINE : HKEY_CURRENT_USER), "Top"+std::to_string(i)), 0);
+    }
+
+    // the nr of keys and values generated, and the estimated hive size
+    uint64_t nentries() const { return _nentries; }
+    uint64_t size() const { return _size; }
+};
+#endif
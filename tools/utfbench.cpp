@@ -0,0 +1,90 @@
+// microbenchmark for the utf-16 <-> utf-8 conversion used in the hive codecs,
+// compared with the itslib conversion functions.
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include "vectorutils.h"
+#include "stringutils.h"
+#include <utfconvert.h>
+
+// registry like names: mostly ascii, with an occasional non-ascii char
+StringList makenames(size_t count, int nonascii_percent)
+{
+    StringList names;
+    srand(1);
+    for (size_t i=0 ; i<count ; i++) {
+        std::string name;
+        int len= 4+rand()%28;
+        for (int j=0 ; j<len ; j++) {
+            if (rand()%100 < nonascii_percent)
+                name += "\xc3\xa9";     // e-acute
+            else
+                name += 'a'+rand()%26;
+        }
+        names.push_back(name);
+    }
+    return names;
+}
+
+template<typename FN>
+double measure(int rounds, FN fn)
+{
+    auto t0= std::chrono::steady_clock::now();
+    for (int r=0 ; r<rounds ; r++)
+        fn();
+    auto t1= std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(t1-t0).count();
+}
+
+void bench(const char *desc, const StringList& names, int rounds)
+{
+    std::vector<ByteVector> encoded;
+    size_t total= 0;
+    for (auto& name : names) {
+        encoded.push_back(ByteVector());
+        utf8toutf16le(name, encoded.back());
+        total += name.size();
+    }
+
+    size_t check= 0;
+    double t_enc_its= measure(rounds, [&]() {
+        for (auto& name : names) {
+            ByteVector bin;
+            BV_AppendWString(bin, ToWString(name));
+            check += bin.size();
+        }
+    });
+    double t_enc_new= measure(rounds, [&]() {
+        for (auto& name : names) {
+            ByteVector bin;
+            utf8toutf16le(name, bin);
+            check += bin.size();
+        }
+    });
+    double t_dec_its= measure(rounds, [&]() {
+        for (auto& bin : encoded) {
+            std::string str= ToString(std::Wstring((const WCHAR*)bin.data(), bin.size()/2));
+            check += str.size();
+        }
+    });
+    double t_dec_new= measure(rounds, [&]() {
+        for (auto& bin : encoded) {
+            std::string str;
+            utf16toutf8(bin.data(), bin.size(), false, true, str);
+            check += str.size();
+        }
+    });
+
+    double mb= double(total)*rounds/1e6;
+    printf("%-24s encode: itslib %7.1f MB/s  utfconvert %7.1f MB/s   decode: itslib %7.1f MB/s  utfconvert %7.1f MB/s  (%zx)\n",
+            desc, mb/t_enc_its, mb/t_enc_new, mb/t_dec_its, mb/t_dec_new, check&0xf);
+}
+
+int main(int argc, char**argv)
+{
+    int rounds= argc>1 ? atoi(argv[1]) : 20;
+    bench("ascii names", makenames(100000, 0), rounds);
+    bench("1% non-ascii names", makenames(100000, 1), rounds);
+    bench("20% non-ascii names", makenames(100000, 20), rounds);
+    return 0;
+}